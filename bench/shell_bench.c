@@ -0,0 +1,546 @@
+// Benchmarks for the code the shell runs on every line and every Tab:
+// parse_command, the PATH scan and lookup, and completion prefix queries,
+// plus an end-to-end replay of a command script through the shell itself
+// and the overhead of its loops.
+//
+// Usage: shell_bench [micro]
+//        shell_bench replay [script|-] [rounds] [shell]
+//        shell_bench loop [iterations] [shell]
+//
+// Without arguments micro and replay run, the replay using a built-in mix
+// of commands. A replayed command's latency is measured from writing it to
+// the shell's stdin until the output of a marker `echo` written after it
+// comes back, so it includes one extra (builtin) command.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmdhash.h"
+#include "complete.h"
+#include "pathscan.h"
+#include "shell.h"
+
+#define PATH_DIRS 16
+#define SCAN_RUNS 5
+#define MARKER "@@shell_bench@@"
+#define READ_CHUNK 65536
+
+extern char **environ;
+
+static const char *default_script[] = {
+    "echo hello world",
+    "pwd",
+    "type ls",
+    "true",
+    "ls /",
+    "echo a b c | cat",
+    "ls / | wc -l",
+    "cd /tmp",
+    "cd /",
+    "hash -t ls",
+    NULL,
+};
+
+static long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_parse(const char *label, const char *line, int iterations)
+{
+  Arena arena = {0};
+  long long start = now_ns();
+  for (int i = 0; i < iterations; i++)
+  {
+    if (parse_command(line, &arena) == NULL)
+    {
+      fprintf(stderr, "parse_command failed on the %s line\n", label);
+      exit(1);
+    }
+    arena_reset(&arena);
+  }
+  double ns = (double)(now_ns() - start) / iterations;
+  size_t length = strlen(line);
+  printf("parse %-8s %7zu bytes %10.1f ns/line %8.1f MB/s\n", label, length, ns, length / ns * 1000);
+  arena_free(&arena);
+}
+
+// `count` copies of `piece` after `prefix`, malloc'd.
+static char *repeat(const char *prefix, const char *piece, int count)
+{
+  size_t piece_length = strlen(piece);
+  char *line = malloc(strlen(prefix) + piece_length * count + 1);
+  if (line == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+  char *out = stpcpy(line, prefix);
+  for (int i = 0; i < count; i++)
+    out = stpcpy(out, piece);
+  return line;
+}
+
+static void run_parse_benchmarks(void)
+{
+  char *long_line = repeat("echo", " argument", 1000);
+  char *quoted_line = repeat("echo", " 'single | quoted' \"double \\\"quoted\\\" > x\" back\\ slash\\ ed", 200);
+
+  bench_parse("short", "ls -la /tmp", 200000);
+  bench_parse("long", long_line, 2000);
+  bench_parse("quoted", quoted_line, 2000);
+
+  free(long_line);
+  free(quoted_line);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+// PATH_DIRS directories under `root` holding `files` empty executables
+// between them, named cmd0, cmd1, ... Returns the PATH for them.
+static char *make_path_tree(const char *root, int files)
+{
+  size_t path_size = PATH_DIRS * (strlen(root) + 16);
+  char *path = malloc(path_size);
+  if (path == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+  path[0] = '\0';
+
+  char name[4096];
+  for (int d = 0; d < PATH_DIRS; d++)
+  {
+    snprintf(name, sizeof(name), "%s/d%d", root, d);
+    if (mkdir(name, 0755) == -1)
+    {
+      perror(name);
+      exit(1);
+    }
+    if (d > 0)
+      strcat(path, ":");
+    strcat(path, name);
+  }
+
+  for (int i = 0; i < files; i++)
+  {
+    snprintf(name, sizeof(name), "%s/d%d/cmd%d", root, i % PATH_DIRS, i);
+    int fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0755);
+    if (fd == -1)
+    {
+      perror(name);
+      exit(1);
+    }
+    close(fd);
+  }
+  return path;
+}
+
+// cmdhash_lookup() as the shell calls it for every command: a hit is a
+// hash probe, a miss walks every PATH directory again.
+static void bench_lookup(const char *label, const char *name, bool expect_hit, int iterations)
+{
+  long long start = now_ns();
+  for (int i = 0; i < iterations; i++)
+  {
+    if ((cmdhash_lookup(name) != NULL) != expect_hit)
+    {
+      fprintf(stderr, "unexpected lookup result for %s\n", name);
+      exit(1);
+    }
+  }
+  printf("  lookup %-6s %10.1f ns\n", label, (double)(now_ns() - start) / iterations);
+}
+
+// Queries as readline makes them: state 0, then one call per match.
+static void bench_completion(const CompletionIndex *index, const char *prefix)
+{
+  int iterations = 0;
+  size_t matches = 0;
+  long long start = now_ns();
+  long long elapsed;
+  do
+  {
+    matches = 0;
+    char *match;
+    for (int state = 0; (match = completion_index_next(index, prefix, state)) != NULL; state++)
+    {
+      matches++;
+      free(match);
+    }
+    iterations++;
+    elapsed = now_ns() - start;
+  } while (elapsed < 100000000LL && iterations < 100000);
+
+  printf("  complete %-10s %7zu matches %12.1f ns/query\n", prefix[0] ? prefix : "\"\"", matches,
+         (double)elapsed / iterations);
+}
+
+static void bench_path_tree(int files)
+{
+  char root[] = "/tmp/shell_bench.XXXXXX";
+  if (mkdtemp(root) == NULL)
+  {
+    perror("mkdtemp");
+    exit(1);
+  }
+  char *path = make_path_tree(root, files);
+  setenv("PATH", path, 1);
+
+  char *tokens[PATH_DIRS];
+  char *saveptr;
+  int token_count = 0;
+  for (char *token = strtok_r(path, ":", &saveptr); token != NULL; token = strtok_r(NULL, ":", &saveptr))
+    tokens[token_count++] = token;
+  cmdhash_set_path(tokens, token_count);
+
+  printf("PATH of %d dirs, %d executables\n", PATH_DIRS, files);
+  double best_ms = 0, total_ms = 0;
+  char **names = NULL;
+  for (int run = 0; run < SCAN_RUNS; run++)
+  {
+    free_executables(names);
+    cmdhash_reset();
+    long long start = now_ns();
+    names = get_executables_from_path();
+    double ms = (now_ns() - start) / 1e6;
+    total_ms += ms;
+    if (run == 0 || ms < best_ms)
+      best_ms = ms;
+  }
+  size_t found = 0;
+  while (names != NULL && names[found] != NULL)
+    found++;
+  printf("  scan   %zu names: best %.2f ms, mean %.2f ms\n", found, best_ms, total_ms / SCAN_RUNS);
+
+  char last[32];
+  snprintf(last, sizeof(last), "cmd%d", files - 1);
+  bench_lookup("hit", last, true, 1000000);
+  bench_lookup("miss", "no_such_command", false, 2000);
+
+  CompletionIndex index = {0};
+  completion_index_merge(&index, names, COMPLETE_EXECUTABLE);
+  bench_completion(&index, "");
+  bench_completion(&index, "cmd1");
+  bench_completion(&index, "cmd12");
+  bench_completion(&index, last);
+  bench_completion(&index, "zz");
+  completion_index_free(&index);
+
+  cmdhash_reset();
+  cmdhash_set_path(NULL, 0);
+  nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  free(path);
+}
+
+static void run_micro_benchmarks(void)
+{
+  run_parse_benchmarks();
+  char *saved_path = getenv("PATH") ? strdup(getenv("PATH")) : NULL;
+  bench_path_tree(1000);
+  bench_path_tree(10000);
+  bench_path_tree(50000);
+  if (saved_path != NULL)
+    setenv("PATH", saved_path, 1);
+  free(saved_path);
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static void write_line(int fd, const char *line)
+{
+  size_t length = strlen(line);
+  while (length > 0)
+  {
+    ssize_t written = write(fd, line, length);
+    if (written == -1)
+    {
+      perror("write");
+      exit(1);
+    }
+    line += written;
+    length -= written;
+  }
+}
+
+// Read the shell's output until the marker shows up. The last bytes of
+// each chunk are carried over in case the marker straddles two reads.
+static void read_until_marker(int fd)
+{
+  static char window[sizeof(MARKER) + READ_CHUNK];
+  size_t carry = 0;
+  while (true)
+  {
+    ssize_t got = read(fd, window + carry, READ_CHUNK);
+    if (got <= 0)
+    {
+      fprintf(stderr, "shell exited during the replay\n");
+      exit(1);
+    }
+    size_t size = carry + got;
+    if (memmem(window, size, MARKER, sizeof(MARKER) - 1) != NULL)
+      return;
+    carry = size < sizeof(MARKER) - 1 ? size : sizeof(MARKER) - 1;
+    memmove(window, window + size - carry, carry);
+  }
+}
+
+static void replay(const char *shell, char **lines, int line_count, int rounds)
+{
+  int to_shell[2], from_shell[2];
+  if (pipe2(to_shell, O_CLOEXEC) == -1 || pipe2(from_shell, O_CLOEXEC) == -1)
+  {
+    perror("pipe2");
+    exit(1);
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, to_shell[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, from_shell[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  char *argv[] = {(char *)shell, NULL};
+  pid_t pid;
+  int error = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0)
+  {
+    fprintf(stderr, "%s: %s\n", shell, strerror(error));
+    exit(1);
+  }
+  close(to_shell[0]);
+  close(from_shell[1]);
+  signal(SIGPIPE, SIG_IGN);
+
+  int total = line_count * rounds;
+  long long *latencies = malloc(total * sizeof(long long));
+  if (latencies == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+
+  char command[8192];
+  long long start = now_ns();
+  for (int i = 0; i < total; i++)
+  {
+    snprintf(command, sizeof(command), "%s\necho " MARKER "\n", lines[i % line_count]);
+    long long sent = now_ns();
+    write_line(to_shell[1], command);
+    read_until_marker(from_shell[0]);
+    latencies[i] = now_ns() - sent;
+  }
+  double seconds = (now_ns() - start) / 1e9;
+
+  close(to_shell[1]);
+  close(from_shell[0]);
+  waitpid(pid, NULL, 0);
+
+  qsort(latencies, total, sizeof(long long), compare_latency);
+  printf("replay %d commands (%d x %d) through %s\n", total, rounds, line_count, shell);
+  printf("  %.0f commands/s, p50 %.1f us, p99 %.1f us, max %.1f us\n", total / seconds,
+         latencies[total / 2] / 1000.0, latencies[(int)(total * 0.99)] / 1000.0, latencies[total - 1] / 1000.0);
+  free(latencies);
+}
+
+// Run `script` through `shell` from a file on its stdin, with stdout
+// discarded, and return how long it took in seconds.
+static double time_script(const char *shell, const char *script)
+{
+  char path[] = "/tmp/shell_bench_loop.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1)
+  {
+    perror("mkstemp");
+    exit(1);
+  }
+  write_line(fd, script);
+  close(fd);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, path, O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  char *argv[] = {(char *)shell, NULL};
+  pid_t pid;
+  long long start = now_ns();
+  int error = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0)
+  {
+    fprintf(stderr, "%s: %s\n", shell, strerror(error));
+    exit(1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  double seconds = (now_ns() - start) / 1e9;
+  unlink(path);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    fprintf(stderr, "loop script failed: %.60s...\n", script);
+    exit(1);
+  }
+  return seconds;
+}
+
+// `prefix`, the numbers 1 to `count` each followed by `separator`, then
+// `suffix`, malloc'd.
+static char *numbered(const char *prefix, int count, const char *separator, const char *suffix)
+{
+  size_t size = strlen(prefix) + (size_t)count * (12 + strlen(separator)) + strlen(suffix) + 1;
+  char *script = malloc(size);
+  if (script == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+  char *out = stpcpy(script, prefix);
+  for (int i = 1; i <= count; i++)
+    out += sprintf(out, "%d%s", i, separator);
+  strcpy(out, suffix);
+  return script;
+}
+
+static void report_loop(const char *shell, const char *label, char *script, int iterations)
+{
+  double seconds = time_script(shell, script);
+  printf("  %-34s %8d iterations %12.0f iterations/s\n", label, iterations, iterations / seconds);
+  free(script);
+}
+
+// Loop overhead in iterations per second, shell startup included: for
+// loops with if and && / || inside, run in-process from a tree parsed
+// once, against the same work spelled out as one line per iteration
+// (parsed every time) and against loops driven by external commands: a
+// for loop running /bin/true, and seq piped into xargs.
+static void run_loop_benchmarks(const char *shell, int iterations)
+{
+  int outer = iterations / 10 > 0 ? iterations / 10 : 1;
+  int external = iterations / 20 > 0 ? iterations / 20 : 1;
+  const char *true_path = access("/bin/true", X_OK) == 0 ? "/bin/true" : "/usr/bin/true";
+  char text[256];
+
+  printf("loops through %s\n", shell);
+  report_loop(shell, "for, builtin body", numbered("for i in ", iterations, " ", "; do true; done\n"), iterations);
+  report_loop(shell, "for, if and &&/|| body",
+              numbered("for i in ", iterations, " ", "; do if false; then true; else true && false || true; fi; done\n"),
+              iterations);
+  report_loop(shell, "nested for, 10 inner passes",
+              numbered("for i in ", outer, " ", "; do for j in 1 2 3 4 5 6 7 8 9 10; do true; done; done\n"),
+              outer * 10);
+  report_loop(shell, "one line per iteration", repeat("", "true\n", iterations), iterations);
+
+  snprintf(text, sizeof(text), "; do %s; done\n", true_path);
+  report_loop(shell, "for, external body", numbered("for i in ", external, " ", text), external);
+  snprintf(text, sizeof(text), "seq %d | xargs -n 1 %s\n", external, true_path);
+  report_loop(shell, "seq | xargs", strdup(text), external);
+}
+
+// Non-empty, non-comment lines of `path`; the file's buffer is kept.
+static char **read_script(const char *path, int *count)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror(path);
+    exit(1);
+  }
+
+  char **lines = NULL;
+  int capacity = 0;
+  *count = 0;
+  char *line = NULL;
+  size_t line_capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &line_capacity, file)) != -1)
+  {
+    if (length > 0 && line[length - 1] == '\n')
+      line[--length] = '\0';
+    if (length == 0 || line[0] == '#')
+      continue;
+    if (*count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      lines = realloc(lines, capacity * sizeof(char *));
+      if (lines == NULL)
+      {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    lines[(*count)++] = strdup(line);
+  }
+  free(line);
+  fclose(file);
+  return lines;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *mode = argc > 1 ? argv[1] : "";
+  bool all = argc == 1;
+  if (!all && strcmp(mode, "micro") != 0 && strcmp(mode, "replay") != 0 && strcmp(mode, "loop") != 0)
+  {
+    fprintf(stderr, "usage: shell_bench [micro]\n       shell_bench replay [script|-] [rounds] [shell]\n"
+                    "       shell_bench loop [iterations] [shell]\n");
+    return 2;
+  }
+
+  if (strcmp(mode, "loop") == 0)
+  {
+    int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+    run_loop_benchmarks(argc > 3 ? argv[3] : SHELL_BINARY, iterations > 0 ? iterations : 1);
+    return 0;
+  }
+
+  if (all || strcmp(mode, "micro") == 0)
+    run_micro_benchmarks();
+  if (!all && strcmp(mode, "replay") != 0)
+    return 0;
+
+  char **lines = (char **)default_script;
+  int line_count = 0;
+  if (argc > 2 && strcmp(argv[2], "-") != 0)
+  {
+    lines = read_script(argv[2], &line_count);
+  }
+  else
+  {
+    while (default_script[line_count] != NULL)
+      line_count++;
+  }
+  if (line_count == 0)
+  {
+    fprintf(stderr, "nothing to replay\n");
+    return 1;
+  }
+
+  int rounds = argc > 3 ? atoi(argv[3]) : 200;
+  const char *shell = argc > 4 ? argv[4] : SHELL_BINARY;
+  replay(shell, lines, line_count, rounds > 0 ? rounds : 1);
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static ArenaBlock *new_block(Arena *arena, size_t min_size)
+{
+  size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  if (block == NULL)
+    return NULL;
+  block->size = size;
+  block->used = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->block_mallocs++;
+  return block;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (size == 0)
+    size = ARENA_ALIGN;
+
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->size - block->used < size)
+  {
+    block = new_block(arena, size);
+    if (block == NULL)
+      return NULL;
+  }
+
+  void *ptr = (char *)block->data + block->used;
+  block->used += size;
+  arena->allocations++;
+  arena->total_allocations++;
+  arena->bytes += size;
+  return ptr;
+}
+
+ArenaMark arena_mark(const Arena *arena)
+{
+  ArenaBlock *block = arena->blocks;
+  return (ArenaMark){block, block != NULL ? block->used : 0, arena->allocations, arena->bytes};
+}
+
+// Give back everything allocated since `mark`: the blocks added since are
+// freed and the one that was current is rewound. Blocks are only ever
+// pushed on the front, so those are exactly the ones in front of it.
+void arena_release(Arena *arena, ArenaMark mark)
+{
+  if (mark.block == NULL)
+  {
+    arena_reset(arena);
+    return;
+  }
+  while (arena->blocks != mark.block)
+  {
+    ArenaBlock *next = arena->blocks->next;
+    free(arena->blocks);
+    arena->blocks = next;
+  }
+  mark.block->used = mark.used;
+  arena->allocations = mark.allocations;
+  arena->bytes = mark.bytes;
+}
+
+// Free every block but the oldest, which is rewound for reuse.
+void arena_reset(Arena *arena)
+{
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL && block->next != NULL)
+  {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  if (block != NULL)
+    block->used = 0;
+  arena->blocks = block;
+  arena->allocations = 0;
+  arena->bytes = 0;
+}
+
+void arena_free(Arena *arena)
+{
+  arena_reset(arena);
+  free(arena->blocks);
+  arena->blocks = NULL;
+}
+
+void print_arena_stats(FILE *out, const Arena *arena)
+{
+  fprintf(out, "arena: %zu allocations (%zu bytes) this line, %zu allocations from %zu mallocs in total\n",
+          arena->allocations, arena->bytes, arena->total_allocations, arena->block_mallocs);
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Bump allocator for everything that lives exactly as long as one input
+// line: the parsed command, its argument strings and the pipeline state.
+// Nothing is freed individually; arena_reset() releases it all at once
+// and keeps the first block around for the next line. A loop that runs
+// its body over and over takes an arena_mark() before each pass and
+// arena_release()s back to it afterwards, so the parsed tree stays while
+// what each pass allocated goes.
+
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+} ArenaBlock;
+
+typedef struct
+{
+  ArenaBlock *blocks;
+  size_t allocations;       // arena_alloc() calls since the last reset
+  size_t bytes;             // Bytes handed out since the last reset
+  size_t total_allocations; // arena_alloc() calls over the arena's lifetime
+  size_t block_mallocs;     // Real malloc() calls over the arena's lifetime
+} Arena;
+
+// Where the arena had got to, for arena_release()
+typedef struct
+{
+  ArenaBlock *block;
+  size_t used;
+  size_t allocations;
+  size_t bytes;
+} ArenaMark;
+
+void *arena_alloc(Arena *arena, size_t size);
+ArenaMark arena_mark(const Arena *arena);
+void arena_release(Arena *arena, ArenaMark mark);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+void print_arena_stats(FILE *out, const Arena *arena);
+
+#endif
@@ -0,0 +1,72 @@
+#include "builtins.h"
+#include "hash.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// Power of two, at least twice the number of builtins
+#define BUILTIN_SLOTS 64
+
+const Builtin builtin_table[] = {
+    {"echo", execute_echo, NULL},
+    {"exit", NULL, NULL},
+    {"type", execute_type, NULL},
+    {"pwd", execute_pwd, NULL},
+    {"cd", execute_cd, NULL},
+    {"hash", execute_hash, NULL},
+    {"jobs", execute_jobs, NULL},
+    {"fg", execute_fg_bg, NULL},
+    {"bg", execute_fg_bg, NULL},
+    {"wait", execute_wait, NULL},
+    {"timeout", execute_timeout_builtin, NULL},
+    {"parallel", execute_parallel_builtin, NULL},
+    {"trace", execute_trace, NULL},
+    {"true", execute_true, NULL},
+    {"false", execute_false, NULL},
+    {"test", execute_test, NULL},
+    {"[", execute_test, NULL},
+    {"printf", execute_printf, NULL},
+    {"cat", execute_cat, cat_accepts},
+    {"export", execute_export, NULL},
+    {"unset", execute_unset, NULL},
+    {NULL, NULL, NULL},
+};
+
+static const Builtin *slots[BUILTIN_SLOTS];
+static bool slots_filled = false;
+
+static void fill_slots(void)
+{
+  for (const Builtin *builtin = builtin_table; builtin->name != NULL; builtin++)
+  {
+    size_t slot = hash_string(builtin->name) & (BUILTIN_SLOTS - 1);
+    while (slots[slot] != NULL)
+      slot = (slot + 1) & (BUILTIN_SLOTS - 1);
+    slots[slot] = builtin;
+  }
+  slots_filled = true;
+}
+
+const Builtin *find_builtin(const char *name)
+{
+  if (!slots_filled)
+    fill_slots();
+
+  for (size_t slot = hash_string(name) & (BUILTIN_SLOTS - 1); slots[slot] != NULL;
+       slot = (slot + 1) & (BUILTIN_SLOTS - 1))
+  {
+    if (strcmp(slots[slot]->name, name) == 0)
+      return slots[slot];
+  }
+  return NULL;
+}
+
+// The builtin that runs `cmd`, whose words end at `end_index`; NULL if
+// there is none, or if it leaves these arguments to the program in PATH
+const Builtin *find_builtin_for(const Command *cmd, int end_index)
+{
+  const Builtin *builtin = find_builtin(cmd->name);
+  if (builtin != NULL && builtin->accepts != NULL && !builtin->accepts(cmd, end_index))
+    return NULL;
+  return builtin;
+}
@@ -0,0 +1,56 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdio.h>
+
+#include "shell.h"
+
+// Builtin registry: one table of name -> handler, looked up through a
+// small open-addressing hash so dispatch is one probe and one strcmp.
+// A handler gets the words before any redirection operator as
+// cmd->args[0..end_index) and writes its output to `out`; it reports
+// failure with record_status(), the status being 0 otherwise. A builtin
+// standing in for a common utility can leave the arguments it does not
+// handle, such as options it lacks, to the program in PATH.
+
+typedef void (*BuiltinHandler)(const Command *cmd, int end_index, FILE *out);
+typedef bool (*BuiltinAccepts)(const Command *cmd, int end_index);
+
+typedef struct
+{
+  const char *name;
+  BuiltinHandler run;     // NULL for exit, which execute_command() handles
+  BuiltinAccepts accepts; // NULL if it runs any arguments itself
+} Builtin;
+
+extern const Builtin builtin_table[]; // Ends with a NULL name
+
+const Builtin *find_builtin(const char *name);
+const Builtin *find_builtin_for(const Command *cmd, int end_index);
+
+// main.c
+void execute_echo(const Command *cmd, int end_index, FILE *out);
+void execute_pwd(const Command *cmd, int end_index, FILE *out);
+void execute_cd(const Command *cmd, int end_index, FILE *out);
+void execute_type(const Command *cmd, int end_index, FILE *out);
+void execute_hash(const Command *cmd, int end_index, FILE *out);
+void execute_jobs(const Command *cmd, int end_index, FILE *out);
+void execute_fg_bg(const Command *cmd, int end_index, FILE *out);
+void execute_wait(const Command *cmd, int end_index, FILE *out);
+void execute_timeout_builtin(const Command *cmd, int end_index, FILE *out);
+void execute_parallel_builtin(const Command *cmd, int end_index, FILE *out);
+void execute_trace(const Command *cmd, int end_index, FILE *out);
+
+// utilities.c: common utilities run in-process instead of fork+exec
+void execute_true(const Command *cmd, int end_index, FILE *out);
+void execute_false(const Command *cmd, int end_index, FILE *out);
+void execute_test(const Command *cmd, int end_index, FILE *out);
+void execute_printf(const Command *cmd, int end_index, FILE *out);
+void execute_cat(const Command *cmd, int end_index, FILE *out);
+bool cat_accepts(const Command *cmd, int end_index);
+
+// vars.c
+void execute_export(const Command *cmd, int end_index, FILE *out);
+void execute_unset(const Command *cmd, int end_index, FILE *out);
+
+#endif
@@ -0,0 +1,254 @@
+#include "cmdhash.h"
+#include "hash.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CMDHASH_INITIAL_BUCKETS 64
+
+typedef struct CmdHashEntry
+{
+  char *name;
+  char *path;
+  unsigned int hits;
+  bool remembered; // false for entries seeded by the PATH scan but never used
+  struct CmdHashEntry *next;
+} CmdHashEntry;
+
+static CmdHashEntry **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t entry_count = 0;
+static unsigned long total_hits = 0;
+static unsigned long total_misses = 0;
+
+static char **search_tokens = NULL;
+static int search_count = 0;
+
+static void grow_buckets(void)
+{
+  size_t new_count = bucket_count ? bucket_count * 2 : CMDHASH_INITIAL_BUCKETS;
+  CmdHashEntry **new_buckets = calloc(new_count, sizeof(CmdHashEntry *));
+  if (new_buckets == NULL)
+    return;
+
+  for (size_t i = 0; i < bucket_count; i++)
+  {
+    CmdHashEntry *entry = buckets[i];
+    while (entry)
+    {
+      CmdHashEntry *next = entry->next;
+      size_t slot = hash_string(entry->name) & (new_count - 1);
+      entry->next = new_buckets[slot];
+      new_buckets[slot] = entry;
+      entry = next;
+    }
+  }
+  free(buckets);
+  buckets = new_buckets;
+  bucket_count = new_count;
+}
+
+static CmdHashEntry *find_entry(const char *name)
+{
+  if (bucket_count == 0)
+    return NULL;
+  for (CmdHashEntry *e = buckets[hash_string(name) & (bucket_count - 1)]; e; e = e->next)
+  {
+    if (strcmp(e->name, name) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+static CmdHashEntry *insert_entry(const char *name, char *path, bool remembered)
+{
+  if (entry_count >= bucket_count)
+    grow_buckets();
+  if (bucket_count == 0)
+  {
+    free(path);
+    return NULL;
+  }
+
+  CmdHashEntry *entry = malloc(sizeof(CmdHashEntry));
+  if (entry == NULL || (entry->name = strdup(name)) == NULL)
+  {
+    free(entry);
+    free(path);
+    return NULL;
+  }
+  entry->path = path;
+  entry->hits = 0;
+  entry->remembered = remembered;
+
+  size_t slot = hash_string(name) & (bucket_count - 1);
+  entry->next = buckets[slot];
+  buckets[slot] = entry;
+  entry_count++;
+  return entry;
+}
+
+// Whether `name` (relative to `dir_fd`) is a regular file this process
+// may execute, by the same rule execve() applies: any execute bit for
+// root, the owner, group or other bit that applies to us otherwise.
+// Lookup and the PATH scan both use it so completion and type agree.
+bool is_executable_at(int dir_fd, const char *name)
+{
+  struct stat st;
+  return fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+         faccessat(dir_fd, name, X_OK, AT_EACCESS) == 0;
+}
+
+bool is_executable_file(const char *path)
+{
+  return is_executable_at(AT_FDCWD, path);
+}
+
+char *search_path(const char *name, char **path_tokens, int path_count)
+{
+  char fullpath[PATH_MAX];
+  for (int i = 0; i < path_count; i++)
+  {
+    int len = snprintf(fullpath, sizeof(fullpath), "%s/%s", path_tokens[i], name);
+    if (len < (int)sizeof(fullpath) && is_executable_file(fullpath))
+      return strdup(fullpath);
+  }
+  return NULL;
+}
+
+void cmdhash_set_path(char **path_tokens, int path_count)
+{
+  search_tokens = path_tokens;
+  search_count = path_count;
+}
+
+// Resolve `name` for execution, searching PATH only on a cache miss.
+const char *cmdhash_lookup(const char *name)
+{
+  if (strchr(name, '/') != NULL)
+    return is_executable_file(name) ? name : NULL;
+
+  CmdHashEntry *entry = find_entry(name);
+  if (entry != NULL)
+  {
+    total_hits++;
+    entry->remembered = true;
+    entry->hits++;
+    return entry->path;
+  }
+
+  total_misses++;
+  char *path = search_path(name, search_tokens, search_count);
+  if (path == NULL)
+    return NULL;
+  entry = insert_entry(name, path, true);
+  if (entry == NULL)
+    return NULL;
+  entry->hits++;
+  return entry->path;
+}
+
+// Return the remembered location of `name` without searching PATH.
+const char *cmdhash_find(const char *name)
+{
+  CmdHashEntry *entry = find_entry(name);
+  if (entry == NULL || !entry->remembered)
+    return NULL;
+  return entry->path;
+}
+
+bool cmdhash_remember(const char *name)
+{
+  CmdHashEntry *entry = find_entry(name);
+  if (entry != NULL)
+  {
+    entry->remembered = true;
+    return true;
+  }
+
+  char *path = search_path(name, search_tokens, search_count);
+  if (path == NULL)
+    return false;
+  return insert_entry(name, path, true) != NULL;
+}
+
+// Record where the PATH scan found `name` without marking it as used.
+void cmdhash_seed(const char *dir, const char *name)
+{
+  if (find_entry(name) != NULL)
+    return;
+  size_t len = strlen(dir) + strlen(name) + 2;
+  char *path = malloc(len);
+  if (path == NULL)
+    return;
+  snprintf(path, len, "%s/%s", dir, name);
+  insert_entry(name, path, false);
+}
+
+void cmdhash_forget(const char *name)
+{
+  if (bucket_count == 0)
+    return;
+  CmdHashEntry **link = &buckets[hash_string(name) & (bucket_count - 1)];
+  while (*link)
+  {
+    CmdHashEntry *entry = *link;
+    if (strcmp(entry->name, name) == 0)
+    {
+      *link = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+      entry_count--;
+      return;
+    }
+    link = &entry->next;
+  }
+}
+
+void cmdhash_reset(void)
+{
+  for (size_t i = 0; i < bucket_count; i++)
+  {
+    CmdHashEntry *entry = buckets[i];
+    while (entry)
+    {
+      CmdHashEntry *next = entry->next;
+      free(entry->name);
+      free(entry->path);
+      free(entry);
+      entry = next;
+    }
+    buckets[i] = NULL;
+  }
+  entry_count = 0;
+}
+
+void cmdhash_print(FILE *out)
+{
+  bool empty = true;
+  for (size_t i = 0; i < bucket_count; i++)
+  {
+    for (CmdHashEntry *e = buckets[i]; e; e = e->next)
+    {
+      if (!e->remembered)
+        continue;
+      if (empty)
+        fprintf(out, "hits\tcommand\n");
+      empty = false;
+      fprintf(out, "%4u\t%s\n", e->hits, e->path);
+    }
+  }
+  if (empty)
+    fprintf(out, "hash: hash table empty\n");
+}
+
+void cmdhash_stats(unsigned long *hits, unsigned long *misses)
+{
+  *hits = total_hits;
+  *misses = total_misses;
+}
@@ -0,0 +1,23 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Command-location cache: maps a command name to the absolute path it
+// resolves to in PATH, so repeated lookups skip the stat() walk.
+
+void cmdhash_set_path(char **path_tokens, int path_count);
+const char *cmdhash_lookup(const char *name);
+const char *cmdhash_find(const char *name);
+bool cmdhash_remember(const char *name);
+void cmdhash_seed(const char *dir, const char *name);
+void cmdhash_forget(const char *name);
+void cmdhash_reset(void);
+void cmdhash_print(FILE *out);
+void cmdhash_stats(unsigned long *hits, unsigned long *misses);
+char *search_path(const char *name, char **path_tokens, int path_count);
+bool is_executable_at(int dir_fd, const char *name);
+bool is_executable_file(const char *path);
+
+#endif
@@ -0,0 +1,194 @@
+#include "complete.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_INDEX_CAPACITY 64
+
+static bool reserve(CompletionIndex *index, size_t needed)
+{
+  if (needed <= index->capacity)
+    return true;
+  size_t new_capacity = index->capacity ? index->capacity : INITIAL_INDEX_CAPACITY;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  CompletionEntry *tmp = realloc(index->entries, new_capacity * sizeof(CompletionEntry));
+  if (!tmp)
+    return false;
+  index->entries = tmp;
+  index->capacity = new_capacity;
+  return true;
+}
+
+// First position whose name is not less than `name`.
+static size_t lower_bound(const CompletionIndex *index, const char *name)
+{
+  size_t lo = 0, hi = index->count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(index->entries[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+bool completion_index_add(CompletionIndex *index, const char *name, unsigned int source)
+{
+  size_t pos = lower_bound(index, name);
+  if (pos < index->count && strcmp(index->entries[pos].name, name) == 0)
+  {
+    index->entries[pos].sources |= source;
+    return true;
+  }
+
+  char *copy = strdup(name);
+  if (!copy || !reserve(index, index->count + 1))
+  {
+    free(copy);
+    return false;
+  }
+  memmove(&index->entries[pos + 1], &index->entries[pos], (index->count - pos) * sizeof(CompletionEntry));
+  index->entries[pos] = (CompletionEntry){.name = copy, .sources = source};
+  index->count++;
+  return true;
+}
+
+// Drop `source` from `name`; the entry goes once nothing provides it.
+void completion_index_remove(CompletionIndex *index, const char *name, unsigned int source)
+{
+  size_t pos = lower_bound(index, name);
+  if (pos == index->count || strcmp(index->entries[pos].name, name) != 0)
+    return;
+
+  index->entries[pos].sources &= ~source;
+  if (index->entries[pos].sources != 0)
+    return;
+
+  free(index->entries[pos].name);
+  index->count--;
+  memmove(&index->entries[pos], &index->entries[pos + 1], (index->count - pos) * sizeof(CompletionEntry));
+}
+
+// Drop `source` from every entry in one compaction pass.
+void completion_index_drop_source(CompletionIndex *index, unsigned int source)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < index->count; i++)
+  {
+    index->entries[i].sources &= ~source;
+    if (index->entries[i].sources == 0)
+      free(index->entries[i].name);
+    else
+      index->entries[kept++] = index->entries[i];
+  }
+  index->count = kept;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Merge a NULL-terminated, duplicate-free name list into the index in one
+// linear pass. Takes ownership of `names` and the strings in it.
+bool completion_index_merge(CompletionIndex *index, char **names, unsigned int source)
+{
+  if (!names)
+    return true;
+
+  size_t count = 0;
+  while (names[count])
+    count++;
+  qsort(names, count, sizeof(char *), compare_names);
+
+  size_t capacity = index->count + count + 1;
+  CompletionEntry *merged = malloc(capacity * sizeof(CompletionEntry));
+  if (!merged)
+  {
+    for (size_t i = 0; i < count; i++)
+      free(names[i]);
+    free(names);
+    return false;
+  }
+
+  size_t i = 0, j = 0, n = 0;
+  while (i < index->count || j < count)
+  {
+    int cmp;
+    if (i == index->count)
+      cmp = 1;
+    else if (j == count)
+      cmp = -1;
+    else
+      cmp = strcmp(index->entries[i].name, names[j]);
+
+    if (cmp < 0)
+    {
+      merged[n++] = index->entries[i++];
+    }
+    else if (cmp > 0)
+    {
+      merged[n++] = (CompletionEntry){.name = names[j++], .sources = source};
+    }
+    else
+    {
+      merged[n] = index->entries[i++];
+      merged[n++].sources |= source;
+      free(names[j++]);
+    }
+  }
+
+  free(names);
+  free(index->entries);
+  index->entries = merged;
+  index->count = n;
+  index->capacity = capacity;
+  return true;
+}
+
+// Entries in [*first, *last) are exactly the names starting with `prefix`.
+void completion_index_range(const CompletionIndex *index, const char *prefix, size_t *first, size_t *last)
+{
+  size_t len = strlen(prefix);
+  *first = lower_bound(index, prefix);
+
+  size_t lo = *first, hi = index->count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strncmp(index->entries[mid].name, prefix, len) == 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *last = lo;
+}
+
+// Readline generator over `index`: state 0 starts a query for `prefix`,
+// and each call returns a malloc'd copy of the next match, then NULL.
+char *completion_index_next(const CompletionIndex *index, const char *prefix, int state)
+{
+  static size_t match_index;
+  static size_t match_end;
+
+  if (state == 0)
+    completion_index_range(index, prefix, &match_index, &match_end);
+
+  if (match_index < match_end)
+    return strdup(index->entries[match_index++].name);
+
+  return NULL;
+}
+
+void completion_index_free(CompletionIndex *index)
+{
+  for (size_t i = 0; i < index->count; i++)
+    free(index->entries[i].name);
+  free(index->entries);
+  index->entries = NULL;
+  index->count = 0;
+  index->capacity = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Sorted command-name index for tab completion. A prefix query is two
+// binary searches, so its cost depends on the number of matches rather
+// than on how many names the index holds.
+
+enum
+{
+  COMPLETE_BUILTIN = 1 << 0,
+  COMPLETE_EXECUTABLE = 1 << 1,
+};
+
+typedef struct
+{
+  char *name;
+  unsigned int sources; // COMPLETE_* flags of everything providing this name
+} CompletionEntry;
+
+typedef struct
+{
+  CompletionEntry *entries;
+  size_t count;
+  size_t capacity;
+} CompletionIndex;
+
+bool completion_index_add(CompletionIndex *index, const char *name, unsigned int source);
+void completion_index_remove(CompletionIndex *index, const char *name, unsigned int source);
+void completion_index_drop_source(CompletionIndex *index, unsigned int source);
+bool completion_index_merge(CompletionIndex *index, char **names, unsigned int source);
+void completion_index_range(const CompletionIndex *index, const char *prefix, size_t *first, size_t *last);
+char *completion_index_next(const CompletionIndex *index, const char *prefix, int state);
+void completion_index_free(CompletionIndex *index);
+
+#endif
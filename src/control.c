@@ -0,0 +1,205 @@
+#include "tree.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "vars.h"
+
+#include <signal.h>
+#include <stdio.h>
+
+// Set by ^C, whether it killed a command or reached the shell itself
+// while it ran builtins; the rest of the tree is then skipped
+static bool aborted = false;
+
+static void run_list(const Node *node, Arena *arena);
+
+// NAME=value... with nothing to run sets each variable in turn, so a
+// value can use the ones before it. Values are expanded but not split.
+static void run_assignments(const Node *node, Arena *arena)
+{
+  const Command *cmd = node->cmd;
+  int end = node->redir.operator_index != -1 ? node->redir.operator_index : cmd->arg_count;
+  record_status(0);
+  for (int i = 0; i < end; i++)
+  {
+    const char *assignment = node->expand ? expand_word(cmd->args[i], arena) : cmd->args[i];
+    if (assignment == NULL || !vars_assign(assignment, false))
+    {
+      record_status(1);
+      return;
+    }
+  }
+}
+
+static void run_command(const Node *node, Arena *arena)
+{
+  jobs_reap();
+  if (node->assignment)
+  {
+    // In the background they would go to a subshell, so change nothing
+    if (node->cmd->background)
+      record_status(0);
+    else
+      run_assignments(node, arena);
+    return;
+  }
+
+  Command *cmd = node->cmd;
+  const Redirection *redir = &node->redir;
+  Redirection expanded_redir;
+  if (node->expand)
+  {
+    // The words have moved, so the redirections are found again
+    cmd = expand_command(cmd, arena);
+    if (cmd == NULL || (!has_pipeline(cmd) && !cmd->background && !parse_redirection(cmd, &expanded_redir, arena)))
+    {
+      record_status(1);
+      return;
+    }
+    redir = &expanded_redir;
+  }
+
+  if (cmd->arg_count > 0)
+  {
+    if (has_pipeline(cmd) || cmd->background)
+      execute_pipeline(cmd, arena);
+    else
+      execute_command(cmd, redir, arena);
+  }
+  else
+  {
+    record_status(0); // Only expansions, all empty
+  }
+  fflush(stdout); // Anything printed outside a builtin's Output
+}
+
+// The status of an if is that of the branch it ran, or 0 if none
+static void run_if(const Node *node, Arena *arena)
+{
+  run_list(node->condition, arena);
+  if (aborted)
+    return;
+  if (last_status == 0)
+    run_list(node->body, arena);
+  else if (node->otherwise != NULL)
+    run_list(node->otherwise, arena);
+  else
+    record_status(0);
+}
+
+// Everything a pass allocates, from redirection steps to pipeline state,
+// is released when it ends, so a loop runs in constant memory however
+// many times it goes round. The status of a loop is that of the last pass
+// of its body, or 0 if there was none.
+static void run_while(const Node *node, Arena *arena)
+{
+  int status = 0;
+  while (!aborted)
+  {
+    ArenaMark mark = arena_mark(arena);
+    run_list(node->condition, arena);
+    bool done = aborted || (last_status == 0) == (node->kind == NODE_UNTIL);
+    if (!done)
+    {
+      run_list(node->body, arena);
+      status = last_status;
+    }
+    arena_release(arena, mark);
+    if (done)
+      break;
+  }
+  if (!aborted)
+    record_status(status);
+}
+
+// The words are expanded once, before the first pass, and the variable
+// is a shell variable like any other: exported only if it already was.
+static void run_for(const Node *node, Arena *arena)
+{
+  char **words = node->words;
+  int word_count = node->word_count;
+  if (node->expand && !expand_words(node->words, node->word_count, &words, &word_count, arena))
+  {
+    record_status(1);
+    return;
+  }
+
+  for (int i = 0; i < word_count && !aborted; i++)
+  {
+    if (!vars_set(node->variable, words[i]))
+    {
+      record_status(1);
+      return;
+    }
+    ArenaMark mark = arena_mark(arena);
+    run_list(node->body, arena);
+    arena_release(arena, mark);
+  }
+  if (word_count == 0)
+    record_status(0);
+}
+
+static void run_node(const Node *node, Arena *arena)
+{
+  MetricsSpan span;
+  if (node->timed)
+    metrics_begin(&span);
+
+  switch (node->kind)
+  {
+  case NODE_COMMAND:
+    run_command(node, arena);
+    break;
+  case NODE_IF:
+    run_if(node, arena);
+    break;
+  case NODE_WHILE:
+  case NODE_UNTIL:
+    run_while(node, arena);
+    break;
+  case NODE_FOR:
+    run_for(node, arena);
+    break;
+  }
+
+  if (node->timed)
+  {
+    Metrics metrics;
+    metrics_end(&span, &metrics);
+    print_time(stderr, &metrics);
+  }
+}
+
+static void run_list(const Node *node, Arena *arena)
+{
+  while (node != NULL && !aborted)
+  {
+    run_node(node, arena);
+    bool interrupted = jobs_take_interrupt(); // Only builtins ran, so the shell got the ^C
+    if (interrupted || last_status == 128 + SIGINT)
+    {
+      if (interrupted)
+      {
+        fprintf(stderr, "\n");
+        record_status(128 + SIGINT);
+      }
+      aborted = true;
+      return;
+    }
+
+    // After a failure the nodes behind && are skipped, after a success
+    // those behind ||, up to one that runs either way
+    while (node != NULL &&
+           ((node->link == LINK_AND && last_status != 0) || (node->link == LINK_OR && last_status == 0)))
+      node = node->next;
+    if (node != NULL)
+      node = node->next;
+  }
+}
+
+// Run a tree parse_tree() built. A command or a whole loop stopped by ^C
+// ends it, as it would in an interactive bash.
+void execute_tree(const Node *tree, Arena *arena)
+{
+  aborted = false;
+  run_list(tree, arena);
+}
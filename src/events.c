@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+
+#include "events.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static sigset_t waited_signals;
+static sigset_t saved_mask;
+
+// Create the epoll set and the signalfd the first time they are needed.
+static bool events_init(void)
+{
+  if (epoll_fd != -1)
+    return true;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    perror("epoll_create1");
+    return false;
+  }
+
+  sigemptyset(&waited_signals);
+  sigaddset(&waited_signals, SIGCHLD);
+  signal_fd = signalfd(-1, &waited_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  struct epoll_event ev = {.events = EPOLLIN, .data.fd = signal_fd};
+  if (signal_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) == -1)
+  {
+    perror("signalfd");
+    close(epoll_fd);
+    epoll_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+long long events_now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Open a pidfd for `pid` and add it to the set. Returns the pidfd, or -1
+// if there is none (the SIGCHLD path still notices the exit then).
+int events_watch_child(int pid)
+{
+  if (!events_init())
+    return -1;
+
+  int pidfd = pidfd_open(pid, 0);
+  if (pidfd == -1)
+    return -1;
+  fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+
+  struct epoll_event ev = {.events = EPOLLIN, .data.fd = pidfd};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &ev) == -1)
+  {
+    close(pidfd);
+    return -1;
+  }
+  return pidfd;
+}
+
+void events_unwatch_child(int pidfd)
+{
+  if (pidfd == -1)
+    return;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfd, NULL);
+  close(pidfd);
+}
+
+// Route SIGCHLD (and SIGINT if `catch_sigint`) to the signalfd until
+// events_end(). State checked after this cannot miss a signal.
+void events_begin(bool catch_sigint)
+{
+  if (!events_init())
+    return;
+
+  sigset_t signals = waited_signals;
+  if (catch_sigint)
+    sigaddset(&signals, SIGINT);
+  sigprocmask(SIG_BLOCK, &signals, &saved_mask);
+  signalfd(signal_fd, &signals, 0);
+}
+
+// Sleep until the next event, or until `deadline_ms` (events_now_ms()
+// time; negative for none).
+Event events_next(long long deadline_ms)
+{
+  Event event = {EVENT_ERROR, -1};
+  if (epoll_fd == -1)
+    return event;
+
+  while (true)
+  {
+    int timeout = -1;
+    if (deadline_ms >= 0)
+    {
+      long long remaining = deadline_ms - events_now_ms();
+      timeout = remaining > 0 ? (int)remaining : 0;
+    }
+
+    struct epoll_event ev;
+    int n = epoll_wait(epoll_fd, &ev, 1, timeout);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+    {
+      perror("epoll_wait");
+      return event;
+    }
+    if (n == 0)
+    {
+      event.type = EVENT_TIMEOUT;
+      return event;
+    }
+
+    if (ev.data.fd != signal_fd)
+    {
+      event.type = EVENT_CHILD;
+      event.fd = ev.data.fd;
+      return event;
+    }
+
+    struct signalfd_siginfo info;
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+      continue; // Already consumed
+    event.type = info.ssi_signo == SIGINT ? EVENT_INTERRUPT : EVENT_SIGCHLD;
+    return event;
+  }
+}
+
+void events_end(void)
+{
+  if (epoll_fd == -1)
+    return;
+  sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+}
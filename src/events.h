@@ -0,0 +1,33 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+
+// The shell's one place to sleep while children run: an epoll set holding
+// a pidfd per child plus a signalfd for SIGCHLD (stops) and, when asked
+// for, SIGINT. Callers bracket a wait with events_begin()/events_end() so
+// no signal slips by between checking state and sleeping.
+
+typedef enum
+{
+  EVENT_CHILD,     // A watched pidfd is readable: that process has exited
+  EVENT_SIGCHLD,   // Some child changed state; check for stops
+  EVENT_INTERRUPT, // SIGINT
+  EVENT_TIMEOUT,   // The deadline passed
+  EVENT_ERROR
+} EventType;
+
+typedef struct
+{
+  EventType type;
+  int fd; // For EVENT_CHILD, the pidfd
+} Event;
+
+int events_watch_child(int pid);
+void events_unwatch_child(int pidfd);
+void events_begin(bool catch_sigint);
+Event events_next(long long deadline_ms);
+void events_end(void);
+long long events_now_ms(void);
+
+#endif
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+
+#include "shell.h"
+#include "builtins.h"
+#include "cmdhash.h"
+#include "launch.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "trace.h"
+#include "vars.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Headroom below ARG_MAX, the same POSIX leaves xargs
+#define ARG_HEADROOM 2048
+
+int last_status = 0;
+int *pipe_status = NULL;
+int pipe_status_count = 0;
+bool batch_args = false;
+
+// Exit status as $? shows it, from a wait_child() status
+int decode_status(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 1;
+}
+
+static void set_pipe_status(const int *statuses, int count)
+{
+  int *tmp = realloc(pipe_status, (count ? count : 1) * sizeof(int));
+  if (tmp == NULL)
+    return;
+  pipe_status = tmp;
+  memcpy(pipe_status, statuses, count * sizeof(int));
+  pipe_status_count = count;
+  last_status = count ? statuses[count - 1] : 0;
+}
+
+void record_status(int status)
+{
+  set_pipe_status(&status, 1);
+}
+
+// Arguments up to the redirection operator.
+static char **command_argv(const Command *cmd, const Redirection *redir, Arena *arena)
+{
+  if (redir->operator_index == -1)
+    return cmd->args;
+
+  char **argv = arena_alloc(arena, (redir->operator_index + 1) * sizeof(char *));
+  if (argv == NULL)
+    return NULL;
+  for (int i = 0; i < redir->operator_index; i++)
+    argv[i] = cmd->args[i];
+  argv[redir->operator_index] = NULL;
+  return argv;
+}
+
+// Launch an external command; returns its pid, or -1 after reporting the
+// failure and setting `*status` to the exit status it stands for.
+static pid_t launch_external(const char *exec_path, char **argv, int in_fd, int out_fd,
+                             const Redirection *redir, pid_t pgid, int *status)
+{
+  if (argv == NULL)
+  {
+    perror("Memory allocation failed");
+    *status = 1;
+    return -1;
+  }
+
+  pid_t pid = spawn_program(exec_path, argv, vars_environ(), in_fd, out_fd, redir, pgid);
+  int spawn_errno = errno;
+
+  if (pid == SPAWN_REDIRECT_FAILED)
+  {
+    *status = 1;
+    return -1;
+  }
+  if (pid == -1)
+  {
+    if (spawn_errno == ENOENT)
+    {
+      cmdhash_forget(argv[0]); // Stale location, search PATH again next time
+      *status = 127;
+    }
+    else
+    {
+      fprintf(stderr, "%s: %s\n", argv[0], strerror(spawn_errno));
+      *status = 126;
+    }
+    return -1;
+  }
+  return pid;
+}
+
+// Run one external command as a foreground job of its own and return its
+// exit status. If it cannot be started that is the status launch_external
+// chose; if it is stopped it stays behind in the job table and the status
+// is 128+SIGTSTP. With `timeout_ms` >= 0 it always gets its own process
+// group, which is sent SIGTERM at the deadline; the status is then 124.
+static int run_foreground(const char *exec_path, char **argv, const char *text, const Redirection *redir,
+                          long long timeout_ms)
+{
+  Job *job = job_create(text);
+  if (job == NULL)
+  {
+    perror("Memory allocation failed");
+    return 1;
+  }
+  if (timeout_ms >= 0 && job->pgid == -1)
+    job->pgid = 0;
+
+  int status;
+  long long start = trace_begin();
+  pid_t pid = launch_external(exec_path, argv, -1, -1, redir, job->pgid, &status);
+  trace_end("spawn", start, -1);
+  if (pid == -1 || !job_add_process(job, pid))
+  {
+    if (pid != -1)
+      wait_child(pid, &status, 0);
+    job_free(job);
+    return pid == -1 ? status : decode_status(status);
+  }
+
+  start = trace_begin();
+  bool finished = job_foreground(job, false, timeout_ms);
+  trace_end("wait", start, -1);
+  if (!finished)
+    return 128 + SIGTSTP;
+  status = job->timed_out ? 124 : job->statuses[0];
+  job_free(job);
+  return status;
+}
+
+// timeout: run argv[0] from PATH, killing its process group if it is
+// still running after `timeout_ms`.
+int execute_timeout(char **argv, long long timeout_ms, const char *text)
+{
+  const char *exec_path = cmdhash_lookup(argv[0]);
+  if (exec_path == NULL)
+  {
+    fprintf(stderr, "timeout: failed to run command '%s': No such file or directory\n", argv[0]);
+    return 127;
+  }
+
+  Redirection no_redir = {NULL, 0, -1};
+  return run_foreground(exec_path, argv, text, &no_redir, timeout_ms);
+}
+
+// What execve() charges against ARG_MAX for `count` strings: the bytes,
+// their terminators and the pointers to them.
+static size_t vector_size(char *const *vec, int count)
+{
+  size_t size = 0;
+  for (int i = 0; i < count; i++)
+    size += strlen(vec[i]) + 1 + sizeof(char *);
+  return size;
+}
+
+// Bytes left for argument strings once the environment is paid for.
+static size_t argv_budget(void)
+{
+  long arg_max = sysconf(_SC_ARG_MAX);
+  if (arg_max <= 0)
+    arg_max = _POSIX_ARG_MAX;
+
+  char **envp = vars_environ();
+  int env_count = 0;
+  while (envp[env_count] != NULL)
+    env_count++;
+  size_t used = vector_size(envp, env_count) + ARG_HEADROOM;
+  return (size_t)arg_max > used ? (size_t)arg_max - used : 0;
+}
+
+// Leading arguments every batch repeats: the command name and its options,
+// up to and including "--".
+static int fixed_arg_count(char **argv, int argc)
+{
+  int fixed = 1;
+  while (fixed < argc && argv[fixed][0] == '-' && argv[fixed][1] != '\0')
+  {
+    if (strcmp(argv[fixed++], "--") == 0)
+      break;
+  }
+  return fixed;
+}
+
+// Run `argv` as several commands, xargs-style, each with as many of the
+// trailing arguments as fit in `budget`. Later batches append to a
+// redirection the first one truncated. Returns the first failing status;
+// a batch that cannot be started or is stopped ends the run.
+static int execute_batched(const char *exec_path, char **argv, int argc, const char *text,
+                           const Redirection *redir, size_t budget, Arena *arena)
+{
+  char **batch = arena_alloc(arena, (argc + 1) * sizeof(char *));
+  if (batch == NULL)
+  {
+    perror("Memory allocation failed");
+    return 1;
+  }
+
+  int fixed = fixed_arg_count(argv, argc);
+  size_t fixed_size = vector_size(argv, fixed);
+  memcpy(batch, argv, fixed * sizeof(char *));
+  Redirection batch_redir = *redir;
+  batch_redir.steps = arena_alloc(arena, (redir->count ? redir->count : 1) * sizeof(RedirectionStep));
+  if (batch_redir.steps == NULL)
+  {
+    perror("Memory allocation failed");
+    return 1;
+  }
+  memcpy(batch_redir.steps, redir->steps, redir->count * sizeof(RedirectionStep));
+  int result = 0;
+
+  int next = fixed;
+  while (next < argc)
+  {
+    // Always take one argument, so one that can never fit still gets its E2BIG
+    int count = fixed;
+    size_t size = fixed_size;
+    do
+    {
+      size += vector_size(&argv[next], 1);
+      batch[count++] = argv[next++];
+    } while (next < argc && size + vector_size(&argv[next], 1) <= budget);
+    batch[count] = NULL;
+
+    int status = run_foreground(exec_path, batch, text, &batch_redir, -1);
+    if (status == 126 || status == 127 || status == 128 + SIGTSTP)
+      return status;
+    if (result == 0)
+      result = status;
+
+    for (int i = 0; i < batch_redir.count; i++)
+    {
+      if (batch_redir.steps[i].type == REDIRECT_OUTPUT)
+        batch_redir.steps[i].type = REDIRECT_APPEND;
+    }
+  }
+  return result;
+}
+
+int execute_program(const Command *cmd, const Redirection *redir, Arena *arena)
+{
+  long long start = trace_begin();
+  const char *exec_path = cmdhash_lookup(cmd->name);
+  trace_end("lookup", start, -1);
+  if (exec_path == NULL)
+  {
+    record_status(127);
+    return 1; // Command not found, no need to spawn
+  }
+
+  char **argv = command_argv(cmd, redir, arena);
+  int argc = redir->operator_index != -1 ? redir->operator_index : cmd->arg_count;
+  if (batch_args && argv != NULL)
+  {
+    size_t budget = argv_budget();
+    if (vector_size(argv, argc) > budget)
+    {
+      int status = execute_batched(exec_path, argv, argc, cmd->text, redir, budget, arena);
+      record_status(status);
+      return status == 127;
+    }
+  }
+
+  int status = run_foreground(exec_path, argv, cmd->text, redir, -1);
+  record_status(status);
+  if (status == 127)
+  {
+    cmdhash_forget(cmd->name); // Stale location, search PATH again next time
+    return 1;                  // Command not found
+  }
+  return 0; // Command found, but failed
+}
+
+static void close_pipes(int (*pipes)[2], int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+}
+
+// Split `cmd` at every "|" into stage commands whose argument arrays live
+// in `argv_storage`. Returns the number of stages, or -1 on an empty stage.
+static int split_stages(const Command *cmd, Command *stages, char **argv_storage)
+{
+  int stage_count = 0;
+  int start = 0;
+  char **next_argv = argv_storage;
+  for (int i = 0; i <= cmd->arg_count; i++)
+  {
+    if (i < cmd->arg_count && cmd->kinds[i] != TOKEN_PIPE)
+      continue;
+    if (i == start)
+      return -1;
+
+    Command *stage = &stages[stage_count++];
+    stage->args = next_argv;
+    stage->kinds = cmd->kinds + start;
+    stage->arg_count = i - start;
+    for (int j = start; j < i; j++)
+      *next_argv++ = cmd->args[j];
+    *next_argv++ = NULL;
+    stage->name = stage->args[0];
+    stage->text = NULL;
+    stage->background = false;
+    start = i + 1;
+  }
+  return stage_count;
+}
+
+// Remember a started stage in `job`; if even that fails, wait for it
+// here and now instead of losing track of it.
+static void add_stage(Job *job, pid_t *pid, int *status)
+{
+  if (*pid == -1 || job_add_process(job, *pid))
+    return;
+  wait_child(*pid, status, 0);
+  *status = decode_status(*status);
+  *pid = -1;
+}
+
+// Start every stage as one job, then either leave it in the background or
+// wait for it in the foreground. Takes ownership of `job`.
+static void run_stages(Command *stages, int stage_count, int (*pipes)[2], pid_t *pids, int *statuses, Job *job,
+                       bool background, Arena *arena)
+{
+  long long start = trace_begin();
+  int pipe_count = 0;
+  for (; pipe_count < stage_count - 1; pipe_count++)
+  {
+    // Close-on-exec, so spawned stages only keep the ends they dup2
+    if (pipe2(pipes[pipe_count], O_CLOEXEC) == -1)
+    {
+      perror("Pipe failed");
+      close_pipes(pipes, pipe_count);
+      job_free(job);
+      record_status(1);
+      return;
+    }
+  }
+
+  trace_end("pipes", start, -1);
+
+  for (int i = 0; i < stage_count; i++)
+  {
+    Command *stage = &stages[i];
+    start = trace_begin();
+    Redirection redir;
+    bool parsed = parse_redirection(stage, &redir, arena);
+    trace_end("parse_redirection", start, i);
+    int end_index = redir.operator_index != -1 ? redir.operator_index : stage->arg_count;
+    bool builtin = find_builtin_for(stage, end_index) != NULL;
+    start = trace_begin();
+    const char *exec_path = builtin ? NULL : cmdhash_lookup(stage->name);
+    trace_end("lookup", start, i);
+
+    pids[i] = -1;
+    statuses[i] = 127;
+    if (!parsed)
+    {
+      statuses[i] = 1;
+      continue;
+    }
+    if (!builtin && exec_path == NULL)
+    {
+      not_found(stage->name);
+      continue;
+    }
+
+    int in_fd = i > 0 ? pipes[i - 1][0] : -1;
+    int out_fd = i < stage_count - 1 ? pipes[i][1] : -1;
+    start = trace_begin();
+    if (!builtin)
+    {
+      pids[i] = launch_external(exec_path, command_argv(stage, &redir, arena), in_fd, out_fd, &redir, job->pgid,
+                                &statuses[i]);
+      trace_end("spawn", start, i);
+      if (pids[i] == -1 && statuses[i] == 127)
+        not_found(stage->name);
+      add_stage(job, &pids[i], &statuses[i]);
+      continue;
+    }
+
+    // Builtins still need a forked copy of the shell to run in. It starts
+    // with the rest of the pipeline, so its output streams into the next
+    // stage however large it gets.
+    fflush(stdout); // Or the child would print it again
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      prepare_child(job->pgid);
+      if (in_fd != -1)
+        dup2(in_fd, STDIN_FILENO);
+      if (out_fd != -1)
+        dup2(out_fd, STDOUT_FILENO);
+      close_pipes(pipes, pipe_count);
+
+      execute_command(stage, &redir, arena);
+      exit(last_status);
+    }
+    trace_end("fork", start, i);
+    if (pid == -1)
+    {
+      perror("fork failed");
+      statuses[i] = 1;
+      continue;
+    }
+    pids[i] = pid;
+    add_stage(job, &pids[i], &statuses[i]);
+  }
+
+  // Parent keeps no pipe ends so every reader sees EOF when its writer exits
+  close_pipes(pipes, pipe_count);
+
+  bool finished = true;
+  if (job->count > 0 && !background)
+  {
+    start = trace_begin();
+    finished = job_foreground(job, false, -1);
+    trace_end("wait", start, -1);
+  }
+
+  if (job->count == 0)
+  {
+    job_free(job);
+  }
+  else if (background)
+  {
+    job_background(job);
+    record_status(0);
+    return;
+  }
+  else if (!finished)
+  {
+    for (int i = 0; i < stage_count; i++)
+      statuses[i] = 128 + SIGTSTP; // Stopped, now in the job table
+  }
+  else
+  {
+    // The job's statuses are in stage order, minus stages that never started
+    for (int i = 0, k = 0; i < stage_count; i++)
+    {
+      if (pids[i] == -1)
+        continue;
+      statuses[i] = job->statuses[k++];
+      if (statuses[i] == 127 && !is_builtin(stages[i].name))
+        cmdhash_forget(stages[i].name);
+    }
+    job_free(job);
+  }
+  set_pipe_status(statuses, stage_count);
+}
+
+// Run `cmd1 | cmd2 | ... | cmdN`, or any command line ending in "&". All
+// pipes are created up front and every stage is started before any is
+// waited on; builtin stages run in a child.
+void execute_pipeline(const Command *cmd, Arena *arena)
+{
+  int stage_count = 1;
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    if (cmd->kinds[i] == TOKEN_PIPE)
+      stage_count++;
+  }
+
+  // Pipeline descriptors live in the line's arena with the command itself
+  Command *stages = arena_alloc(arena, stage_count * sizeof(Command));
+  char **argv_storage = arena_alloc(arena, (cmd->arg_count + stage_count) * sizeof(char *));
+  int (*pipes)[2] = arena_alloc(arena, (stage_count > 1 ? stage_count - 1 : 1) * sizeof(int[2]));
+  pid_t *pids = arena_alloc(arena, stage_count * sizeof(pid_t));
+  int *statuses = arena_alloc(arena, stage_count * sizeof(int));
+  Job *job = job_create(cmd->text);
+
+  if (!stages || !argv_storage || !pipes || !pids || !statuses || !job)
+  {
+    perror("Memory allocation failed");
+    job_free(job);
+    record_status(1);
+  }
+  else if (split_stages(cmd, stages, argv_storage) != stage_count)
+  {
+    fprintf(stderr, "syntax error near unexpected token `|'\n");
+    job_free(job);
+    record_status(2);
+  }
+  else
+  {
+    run_stages(stages, stage_count, pipes, pids, statuses, job, cmd->background, arena);
+  }
+}
@@ -0,0 +1,243 @@
+#include "vars.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The words a command expands to, in an argument vector that grows in
+// the arena like the parser's
+typedef struct
+{
+  char **args;
+  TokenKind *kinds;
+  int count;
+  int capacity;
+  Arena *arena;
+} Fields;
+
+static bool grow_fields(Fields *fields)
+{
+  int capacity = fields->capacity * 2 + 8;
+  char **args = arena_alloc(fields->arena, (capacity + 1) * sizeof(char *));
+  TokenKind *kinds = arena_alloc(fields->arena, capacity * sizeof(TokenKind));
+  if (args == NULL || kinds == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+  if (fields->count > 0)
+  {
+    memcpy(args, fields->args, fields->count * sizeof(char *));
+    memcpy(kinds, fields->kinds, fields->count * sizeof(TokenKind));
+  }
+  fields->args = args;
+  fields->kinds = kinds;
+  fields->capacity = capacity;
+  return true;
+}
+
+static bool add_field(Fields *fields, char *word, TokenKind kind)
+{
+  if (fields->count == fields->capacity && !grow_fields(fields))
+    return false;
+  fields->args[fields->count] = word;
+  fields->kinds[fields->count++] = kind;
+  return true;
+}
+
+// PIPESTATUS: the status of every stage of the last pipeline, separated
+// by spaces, in a buffer kept for the next time
+static const char *pipe_status_text(void)
+{
+  static char *text = NULL;
+  static size_t text_size = 0;
+
+  size_t size = pipe_status_count * 12 + 1; // "-2147483648 " at most each
+  if (size > text_size)
+  {
+    char *grown = realloc(text, size);
+    if (grown == NULL)
+      return "";
+    text = grown;
+    text_size = size;
+  }
+  char *out = text;
+  *out = '\0';
+  for (int i = 0; i < pipe_status_count; i++)
+    out += snprintf(out, text + text_size - out, i > 0 ? " %d" : "%d", pipe_status[i]);
+  return text;
+}
+
+// The value of the parameter whose name runs from `name` to `end`, NULL if
+// it is unset. $? and $$ are written into `number`; PIPESTATUS is made
+// from the last pipeline rather than stored after each one.
+static const char *parameter_value(const char *name, const char *end, char *number, size_t number_size)
+{
+  if (end - name == 1 && (*name == '?' || *name == '$'))
+  {
+    snprintf(number, number_size, "%d", *name == '?' ? last_status : (int)getpid());
+    return number;
+  }
+  if (end - name == 10 && memcmp(name, "PIPESTATUS", 10) == 0)
+    return pipe_status_text();
+  return vars_lookup(name, end - name);
+}
+
+static bool is_field_separator(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Expand the marks in `word` and add the result to `fields`: split at the
+// blanks and newlines in unquoted values if `split`, so that it may come
+// to no field at all, and as exactly one field otherwise.
+static bool expand_into(const char *word, bool split, Fields *fields)
+{
+  char number[24];
+
+  // Everything unsplit, plus a terminator. Splitting drops at least one
+  // separator for every terminator it adds, so this is enough for both.
+  size_t size = 1;
+  for (const char *p = word; *p; p++)
+  {
+    if (*p == EXPAND_UNQUOTED || *p == EXPAND_QUOTED)
+    {
+      const char *name = p + 1;
+      p = strchr(name, EXPAND_END);
+      const char *value = parameter_value(name, p, number, sizeof(number));
+      size += value != NULL ? strlen(value) : 0;
+    }
+    else
+    {
+      p += *p == EXPAND_END;
+      size++;
+    }
+  }
+  char *out = arena_alloc(fields->arena, size);
+  if (out == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  char *field = out;
+  bool in_field = !split; // Whether there is a field to add, empty or not
+  for (const char *p = word; *p; p++)
+  {
+    if (*p == EXPAND_UNQUOTED || *p == EXPAND_QUOTED)
+    {
+      bool quoted = *p == EXPAND_QUOTED;
+      const char *name = p + 1;
+      p = strchr(name, EXPAND_END);
+      const char *value = parameter_value(name, p, number, sizeof(number));
+      if (value == NULL)
+        value = "";
+      if (quoted || !split)
+      {
+        out = stpcpy(out, value);
+        in_field = true;
+        continue;
+      }
+      for (; *value; value++)
+      {
+        if (!is_field_separator(*value))
+        {
+          *out++ = *value;
+          in_field = true;
+        }
+        else if (in_field)
+        {
+          *out++ = '\0';
+          if (!add_field(fields, field, TOKEN_WORD))
+            return false;
+          field = out;
+          in_field = false;
+        }
+      }
+    }
+    else
+    {
+      p += *p == EXPAND_END;
+      *out++ = *p;
+      in_field = true;
+    }
+  }
+  *out = '\0';
+  return !in_field || add_field(fields, field, TOKEN_WORD);
+}
+
+// `cmd` with its $ expansions made, as a new Command from `arena`. Words
+// without any are shared; the text stays as typed.
+Command *expand_command(const Command *cmd, Arena *arena)
+{
+  Command *expanded = arena_alloc(arena, sizeof(Command));
+  Fields fields = {NULL, NULL, 0, 0, arena};
+  if (expanded == NULL)
+  {
+    perror("Memory allocation failed");
+    return NULL;
+  }
+  if (!grow_fields(&fields))
+    return NULL;
+
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    char *word = cmd->args[i];
+    bool added;
+    if (cmd->kinds[i] == TOKEN_REDIRECT && i + 1 < cmd->arg_count)
+    {
+      // The operand is one word whatever it expands to; a here-document
+      // body is raw text
+      bool body = word[0] == '<' && word[1] == '<' && word[2] != '<';
+      char *operand = cmd->args[++i];
+      added = add_field(&fields, word, TOKEN_REDIRECT) &&
+              (body || strpbrk(operand, EXPAND_MARKS) == NULL ? add_field(&fields, operand, TOKEN_WORD)
+                                                               : expand_into(operand, false, &fields));
+    }
+    else if (cmd->kinds[i] != TOKEN_WORD || strpbrk(word, EXPAND_MARKS) == NULL)
+    {
+      added = add_field(&fields, word, cmd->kinds[i]);
+    }
+    else
+    {
+      added = expand_into(word, true, &fields);
+    }
+    if (!added)
+      return NULL;
+  }
+
+  fields.args[fields.count] = NULL;
+  expanded->name = fields.args[0];
+  expanded->args = fields.args;
+  expanded->arg_count = fields.count;
+  expanded->kinds = fields.kinds;
+  expanded->text = cmd->text;
+  expanded->background = cmd->background;
+  return expanded;
+}
+
+// One word expanded but not split, as for the value in NAME=value
+char *expand_word(const char *word, Arena *arena)
+{
+  Fields fields = {NULL, NULL, 0, 0, arena};
+  return expand_into(word, false, &fields) ? fields.args[0] : NULL;
+}
+
+// The words of a for loop, expanded and split like a command's
+bool expand_words(char **words, int count, char ***result, int *result_count, Arena *arena)
+{
+  Fields fields = {NULL, NULL, 0, 0, arena};
+  if (!grow_fields(&fields))
+    return false;
+  for (int i = 0; i < count; i++)
+  {
+    bool added = strpbrk(words[i], EXPAND_MARKS) == NULL ? add_field(&fields, words[i], TOKEN_WORD)
+                                                          : expand_into(words[i], true, &fields);
+    if (!added)
+      return false;
+  }
+  *result = fields.args;
+  *result_count = fields.count;
+  return true;
+}
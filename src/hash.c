@@ -0,0 +1,26 @@
+#include "hash.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+uint64_t hash_bytes(const char *data, size_t length)
+{
+  uint64_t h = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < length; i++)
+  {
+    h ^= (unsigned char)data[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+uint64_t hash_string(const char *text)
+{
+  uint64_t h = FNV_OFFSET_BASIS;
+  for (const unsigned char *p = (const unsigned char *)text; *p; p++)
+  {
+    h ^= *p;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
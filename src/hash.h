@@ -0,0 +1,14 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a, the hash behind every table keyed by a name: the builtins,
+// variables, command cache and PATH scan, and the script cache's file
+// names, which depend on it staying the same.
+
+uint64_t hash_bytes(const char *data, size_t length);
+uint64_t hash_string(const char *text);
+
+#endif
@@ -0,0 +1,596 @@
+#include "jobs.h"
+#include "events.h"
+#include "metrics.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+bool job_control = false;
+
+static Job **jobs = NULL; // The table, oldest first
+static int job_count = 0;
+static int job_capacity = 0;
+
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+static volatile sig_atomic_t children_changed = 0;
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigchld(int sig)
+{
+  (void)sig;
+  children_changed = 1;
+}
+
+// Interrupts a blocking `wait` or the line being edited instead of
+// killing the shell
+static void on_sigint(int sig)
+{
+  (void)sig;
+  interrupted = 1;
+}
+
+// Whether ^C was pressed since the last call.
+bool jobs_take_interrupt(void)
+{
+  bool was_interrupted = interrupted;
+  interrupted = 0;
+  return was_interrupted;
+}
+
+// For other users of the event loop: a SIGCHLD it took from the signalfd
+// may be for a background job, which is then reaped at the next safe point.
+void jobs_note_sigchld(void)
+{
+  children_changed = 1;
+}
+
+// Install the SIGCHLD handler and, for an interactive shell on a
+// terminal, put the shell in its own process group and take the terminal.
+void jobs_init(bool interactive)
+{
+  struct sigaction sa = {0};
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  if (!interactive || !isatty(STDIN_FILENO))
+    return;
+
+  // Started in the background: wait until we are put in the foreground
+  while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+    kill(-shell_pgid, SIGTTIN);
+
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+  sa.sa_handler = on_sigint;
+  sa.sa_flags = 0;
+  sigaction(SIGINT, &sa, NULL);
+
+  setpgid(0, 0); // Fails harmlessly if we already lead a session
+  shell_pgid = getpgrp();
+  tcsetpgrp(STDIN_FILENO, shell_pgid);
+  tcgetattr(STDIN_FILENO, &shell_tmodes);
+  job_control = true;
+}
+
+// A job for `command`, without a trailing "&", that has no processes yet.
+Job *job_create(const char *command)
+{
+  Job *job = calloc(1, sizeof(Job));
+  if (job == NULL)
+    return NULL;
+
+  size_t length = command != NULL ? strlen(command) : 0;
+  while (length > 0 && (command[length - 1] == ' ' || command[length - 1] == '\t' || command[length - 1] == '&'))
+    length--;
+  job->command = strndup(command != NULL ? command : "", length);
+  job->pgid = job_control ? 0 : -1;
+  job->state = JOB_RUNNING;
+  return job;
+}
+
+// Record a started process; the first one becomes the group leader. The
+// parent sets the group too, so it is right before either side runs on.
+bool job_add_process(Job *job, pid_t pid)
+{
+  pid_t *pids = realloc(job->pids, (job->count + 1) * sizeof(pid_t));
+  if (pids == NULL)
+    return false;
+  job->pids = pids;
+  int *statuses = realloc(job->statuses, (job->count + 1) * sizeof(int));
+  if (statuses == NULL)
+    return false;
+  job->statuses = statuses;
+  int *pidfds = realloc(job->pidfds, (job->count + 1) * sizeof(int));
+  if (pidfds == NULL)
+    return false;
+  job->pidfds = pidfds;
+
+  if (job->pgid == 0)
+    job->pgid = pid;
+  if (job->pgid > 0)
+    setpgid(pid, job->pgid);
+
+  job->pids[job->count] = pid;
+  job->statuses[job->count] = -1;
+  job->pidfds[job->count] = events_watch_child(pid);
+  job->count++;
+  job->live++;
+  return true;
+}
+
+void job_free(Job *job)
+{
+  if (job == NULL)
+    return;
+  for (int i = 0; i < job->count; i++)
+    events_unwatch_child(job->pidfds[i]);
+  free(job->pids);
+  free(job->statuses);
+  free(job->pidfds);
+  free(job->command);
+  free(job);
+}
+
+static int table_index(const Job *job)
+{
+  for (int i = 0; i < job_count; i++)
+  {
+    if (jobs[i] == job)
+      return i;
+  }
+  return -1;
+}
+
+static bool table_insert(Job *job)
+{
+  if (table_index(job) != -1)
+    return true;
+
+  if (job_count == job_capacity)
+  {
+    int new_capacity = job_capacity ? job_capacity * 2 : 8;
+    Job **tmp = realloc(jobs, new_capacity * sizeof(Job *));
+    if (tmp == NULL)
+      return false;
+    jobs = tmp;
+    job_capacity = new_capacity;
+  }
+
+  job->id = job_count > 0 ? jobs[job_count - 1]->id + 1 : 1;
+  jobs[job_count++] = job;
+  return true;
+}
+
+static void table_remove(const Job *job)
+{
+  int index = table_index(job);
+  if (index == -1)
+    return;
+  memmove(&jobs[index], &jobs[index + 1], (job_count - index - 1) * sizeof(Job *));
+  job_count--;
+}
+
+// "[N]+  State  command", with + for the current job and - for the previous.
+static void print_job(FILE *out, const Job *job)
+{
+  char state[32];
+  int last_status = job->statuses[job->count - 1];
+  if (job->state == JOB_RUNNING)
+    snprintf(state, sizeof(state), "Running");
+  else if (job->state == JOB_STOPPED)
+    snprintf(state, sizeof(state), "Stopped");
+  else if (last_status == 0)
+    snprintf(state, sizeof(state), "Done");
+  else
+    snprintf(state, sizeof(state), "Exit %d", last_status);
+
+  int index = table_index(job);
+  char mark = index == job_count - 1 ? '+' : (index == job_count - 2 ? '-' : ' ');
+  fprintf(out, "[%d]%c  %-24s%s%s\n", job->id, mark, state, job->command, job->state == JOB_RUNNING ? " &" : "");
+}
+
+// Process `index` of `job` is gone: record its status and stop watching it.
+static void process_exited(Job *job, int index, int status)
+{
+  job->statuses[index] = status;
+  events_unwatch_child(job->pidfds[index]);
+  job->pidfds[index] = -1;
+  if (--job->live == 0)
+    job->state = JOB_DONE;
+}
+
+// Collect `job`'s processes that have exited, and with job control notice
+// one that stopped, without blocking. Returns true on a stop.
+static bool check_job(Job *job)
+{
+  bool stopped = false;
+  for (int i = 0; i < job->count; i++)
+  {
+    if (job->statuses[i] != -1)
+      continue;
+
+    int status;
+    pid_t pid = wait_child(job->pids[i], &status, WNOHANG | (job_control ? WUNTRACED : 0));
+    if (pid == -1 && errno == ECHILD)
+      process_exited(job, i, 127); // Not our child any more
+    else if (pid > 0 && WIFSTOPPED(status))
+      stopped = true;
+    else if (pid > 0)
+      process_exited(job, i, decode_status(status));
+  }
+  return stopped;
+}
+
+// A watched pidfd became readable: reap the process it belongs to, in
+// `job` or in the table.
+static void child_exited(Job *job, int pidfd)
+{
+  for (int j = -1; j < job_count; j++)
+  {
+    Job *owner = j == -1 ? job : jobs[j];
+    for (int i = 0; owner != NULL && i < owner->count; i++)
+    {
+      if (owner->pidfds[i] != pidfd)
+        continue;
+      int status;
+      pid_t pid = wait_child(owner->pids[i], &status, WNOHANG);
+      if (pid > 0)
+        process_exited(owner, i, decode_status(status));
+      else if (pid == -1)
+        process_exited(owner, i, 127);
+      return;
+    }
+  }
+  events_unwatch_child(pidfd); // Nobody's; should not happen
+}
+
+static Job *first_done_job(void)
+{
+  for (int i = 0; i < job_count; i++)
+  {
+    if (jobs[i]->state == JOB_DONE)
+      return jobs[i];
+  }
+  return NULL;
+}
+
+// With no event loop and no one job to wait for: block until any child
+// exits and record it in its job. Returns false if there are none left.
+static bool reap_any_blocking(void)
+{
+  int status;
+  pid_t pid = wait_child(-1, &status, 0);
+  if (pid <= 0)
+    return false;
+  for (int j = 0; j < job_count; j++)
+  {
+    for (int i = 0; i < jobs[j]->count; i++)
+    {
+      if (jobs[j]->pids[i] == pid && jobs[j]->statuses[i] == -1)
+      {
+        process_exited(jobs[j], i, decode_status(status));
+        return true;
+      }
+    }
+  }
+  return true; // Not in a job; keep waiting
+}
+
+// Every wait for children goes through here. Sleeps in the event loop
+// until `job` has exited (or stopped, if `stops`), or with `job` NULL
+// until any job in the table has finished. Gives up at `deadline_ms`
+// (events_now_ms() time, negative for none) or, in an interactive shell,
+// on ^C; those return EVENT_TIMEOUT / EVENT_INTERRUPT, success EVENT_CHILD.
+static EventType supervise(Job *job, bool stops, long long deadline_ms)
+{
+  EventType result = EVENT_CHILD;
+  events_begin(job_control);
+  while (true)
+  {
+    if (job != NULL)
+    {
+      if (check_job(job) && stops)
+      {
+        job->state = JOB_STOPPED;
+        break;
+      }
+      if (job->live == 0)
+        break;
+    }
+    else
+    {
+      jobs_reap(); // Safe: nothing runs in the foreground
+      if (first_done_job() != NULL)
+        break;
+    }
+
+    Event event = events_next(deadline_ms);
+    if (event.type == EVENT_CHILD)
+    {
+      child_exited(job, event.fd);
+    }
+    else if (event.type == EVENT_SIGCHLD)
+    {
+      jobs_note_sigchld(); // Background jobs are reaped at the next safe point
+    }
+    else if (event.type == EVENT_INTERRUPT && job != NULL && stops)
+    {
+      continue; // A foreground job has the terminal; ^C was its to handle
+    }
+    else if (event.type == EVENT_ERROR && job != NULL)
+    {
+      // No event loop: fall back to blocking on the processes in turn
+      int status;
+      for (int i = 0; i < job->count; i++)
+      {
+        if (job->statuses[i] == -1 && wait_child(job->pids[i], &status, 0) > 0)
+          process_exited(job, i, decode_status(status));
+      }
+    }
+    else if (event.type == EVENT_ERROR && job == NULL && reap_any_blocking())
+    {
+      continue;
+    }
+    else
+    {
+      if (event.type == EVENT_INTERRUPT)
+        interrupted = 1; // Taken from the signalfd, so the handler never saw it
+      result = event.type;
+      break;
+    }
+  }
+  events_end();
+  return result;
+}
+
+// Give `job` the terminal, continuing it first if `resume` is set, and
+// wait until all its processes have exited or it is stopped. With
+// `timeout_ms` >= 0, the job's process group is sent SIGTERM once that
+// has passed and job->timed_out is set. Returns false if it was stopped;
+// it then stays in (or joins) the job table. Otherwise it has left the
+// table and job->statuses is complete.
+bool job_foreground(Job *job, bool resume, long long timeout_ms)
+{
+  if (job_control)
+  {
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+    if (resume && job->has_tmodes)
+      tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+  }
+  if (resume)
+    kill(job_control ? -job->pgid : job->pids[0], SIGCONT);
+  job->state = JOB_RUNNING;
+
+  long long deadline = timeout_ms >= 0 ? events_now_ms() + timeout_ms : -1;
+  if (supervise(job, job_control, deadline) == EVENT_TIMEOUT)
+  {
+    job->timed_out = true;
+    if (job->pgid > 0)
+      kill(-job->pgid, SIGTERM);
+    for (int i = 0; job->pgid <= 0 && i < job->count; i++)
+      kill(job->pids[i], SIGTERM);
+    supervise(job, job_control, -1);
+  }
+
+  bool stopped = job->state == JOB_STOPPED;
+  bool killed_by_sigint = false;
+  for (int i = 0; i < job->count; i++)
+    killed_by_sigint |= job->statuses[i] == 128 + SIGINT;
+  if (killed_by_sigint && job_control)
+    fprintf(stderr, "\n"); // The ^C did not end with one
+
+  if (job_control)
+  {
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    if (stopped)
+      job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+  }
+
+  if (stopped)
+  {
+    table_insert(job);
+    fprintf(stderr, "\n");
+    print_job(stderr, job);
+    return false;
+  }
+
+  job->state = JOB_DONE;
+  table_remove(job);
+  return true;
+}
+
+// Leave a freshly started job running and return to the prompt.
+void job_background(Job *job)
+{
+  if (!table_insert(job))
+  {
+    job_free(job);
+    return;
+  }
+  if (job_control)
+    fprintf(stderr, "[%d] %d\n", job->id, (int)job->pids[job->count - 1]);
+}
+
+// `bg`: continue a stopped job without giving it the terminal.
+void job_resume_background(Job *job)
+{
+  job->state = JOB_RUNNING;
+  kill(-job->pgid, SIGCONT);
+  fprintf(stderr, "[%d]+ %s &\n", job->id, job->command);
+}
+
+// Block until `job` has exited, remove it from the table and return the
+// status of its last process, or 128+SIGINT if the wait was interrupted.
+int job_wait(Job *job)
+{
+  if (supervise(job, false, -1) == EVENT_INTERRUPT)
+    return 128 + SIGINT; // Still in the table, still running
+
+  int status = job->statuses[job->count - 1];
+  table_remove(job);
+  job_free(job);
+  return status;
+}
+
+// `wait -n`: block until any job in the table finishes, remove it and
+// return its status; 127 if there is nothing to wait for or the wait
+// failed, 128+SIGINT if it was interrupted.
+int job_wait_any(void)
+{
+  if (jobs_next_running() == NULL && first_done_job() == NULL)
+    return 127;
+  EventType result = supervise(NULL, false, -1);
+  if (result == EVENT_INTERRUPT)
+    return 128 + SIGINT;
+
+  Job *job = first_done_job();
+  if (result != EVENT_CHILD || job == NULL)
+    return 127;
+  int status = job->statuses[job->count - 1];
+  table_remove(job);
+  job_free(job);
+  return status;
+}
+
+// "%N", "%+", "%%", "%-" or a bare job number; NULL is the current job.
+Job *job_find(const char *spec)
+{
+  jobs_reap();
+  if (job_count == 0)
+    return NULL;
+  if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+    return jobs[job_count - 1];
+  if (strcmp(spec, "%-") == 0)
+    return job_count > 1 ? jobs[job_count - 2] : NULL;
+
+  if (*spec == '%')
+    spec++;
+  char *end;
+  long id = strtol(spec, &end, 10);
+  if (*spec == '\0' || *end != '\0')
+    return NULL;
+  for (int i = 0; i < job_count; i++)
+  {
+    if (jobs[i]->id == id)
+      return jobs[i];
+  }
+  return NULL;
+}
+
+Job *job_find_pid(pid_t pid)
+{
+  jobs_reap();
+  for (int i = 0; i < job_count; i++)
+  {
+    for (int j = 0; j < jobs[i]->count; j++)
+    {
+      if (jobs[i]->pids[j] == pid)
+        return jobs[i];
+    }
+  }
+  return NULL;
+}
+
+// The oldest job that is still running, for `wait` with no arguments.
+Job *jobs_next_running(void)
+{
+  jobs_reap();
+  for (int i = 0; i < job_count; i++)
+  {
+    if (jobs[i]->state != JOB_STOPPED)
+      return jobs[i];
+  }
+  return NULL;
+}
+
+static void note_status(pid_t pid, int status)
+{
+  for (int i = 0; i < job_count; i++)
+  {
+    Job *job = jobs[i];
+    for (int j = 0; j < job->count; j++)
+    {
+      if (job->pids[j] != pid)
+        continue;
+
+      if (WIFSTOPPED(status))
+      {
+        job->state = JOB_STOPPED;
+      }
+      else if (WIFCONTINUED(status))
+      {
+        job->state = JOB_RUNNING;
+      }
+      else
+      {
+        process_exited(job, j, decode_status(status));
+      }
+      return;
+    }
+  }
+}
+
+// Collect whatever SIGCHLD announced. Only called between commands, when
+// every foreground process has already been waited for, so reaping any
+// child here can only ever pick up background jobs.
+void jobs_reap(void)
+{
+  if (!children_changed)
+    return;
+  children_changed = 0;
+
+  int status;
+  pid_t pid;
+  while ((pid = wait_child(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+    note_status(pid, status);
+}
+
+// Before a prompt: report and forget background jobs that have finished.
+void jobs_notify(void)
+{
+  jobs_reap();
+  for (int i = 0; i < job_count;)
+  {
+    Job *job = jobs[i];
+    if (job->state != JOB_DONE)
+    {
+      i++;
+      continue;
+    }
+    print_job(stderr, job);
+    table_remove(job);
+    job_free(job);
+  }
+}
+
+// `jobs`: list the table; finished jobs are shown once and forgotten.
+void jobs_print(FILE *out)
+{
+  jobs_reap();
+  for (int i = 0; i < job_count; i++)
+    print_job(out, jobs[i]);
+  for (int i = 0; i < job_count;)
+  {
+    Job *job = jobs[i];
+    if (job->state == JOB_DONE)
+    {
+      table_remove(job);
+      job_free(job);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <termios.h>
+
+// Job table and job control. Every command line that starts processes is
+// a job; it only enters the table when it is put in the background or
+// stopped. Waiting happens in the pidfd/epoll event loop (events.c);
+// background children that exit meanwhile are noted by SIGCHLD and reaped
+// at the next safe point (jobs_reap), never by a blocking wait for some
+// other process.
+
+typedef enum
+{
+  JOB_RUNNING,
+  JOB_STOPPED,
+  JOB_DONE
+} JobState;
+
+typedef struct
+{
+  int id;            // %N; 0 until the job enters the table
+  pid_t pgid;        // -1 without job control, 0 until the first process
+  pid_t *pids;       // One per process, in pipeline order
+  int *statuses;     // Exit status per process, -1 while it runs
+  int *pidfds;       // Watched in the event loop; -1 once reaped or unavailable
+  int count;
+  int live;          // Processes that have not exited yet
+  JobState state;
+  char *command;
+  struct termios tmodes; // Terminal modes when it was stopped
+  bool has_tmodes;
+  bool timed_out; // Killed by job_foreground()'s deadline
+} Job;
+
+extern bool job_control;
+
+void jobs_init(bool interactive);
+bool jobs_take_interrupt(void);
+void jobs_note_sigchld(void);
+Job *job_create(const char *command);
+bool job_add_process(Job *job, pid_t pid);
+bool job_foreground(Job *job, bool resume, long long timeout_ms);
+void job_background(Job *job);
+void job_resume_background(Job *job);
+int job_wait(Job *job);
+int job_wait_any(void);
+void job_free(Job *job);
+Job *job_find(const char *spec);
+Job *job_find_pid(pid_t pid);
+Job *jobs_next_running(void);
+void jobs_reap(void);
+void jobs_notify(void);
+void jobs_print(FILE *out);
+
+#endif
@@ -0,0 +1,161 @@
+#include "launch.h"
+#include "redirect.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+SpawnMethod spawn_method = SPAWN_POSIX;
+
+// Signals an interactive shell ignores or catches that its children must
+// get back at their defaults
+static const int child_default_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+
+// In a freshly forked child: join process group `pgid` (0 for a new one,
+// -1 to stay in the shell's) and restore the default signal dispositions.
+void prepare_child(pid_t pgid)
+{
+  if (pgid >= 0)
+    setpgid(0, pgid);
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    signal(child_default_signals[i], SIG_DFL);
+}
+
+// How many arguments `argv` holds, not counting the NULL
+static size_t argv_count(char *const argv[])
+{
+  size_t count = 0;
+  while (argv[count] != NULL)
+    count++;
+  return count;
+}
+
+// Fill `sh_argv`, which has room for argv_count(argv) + 2 pointers, with
+// the arguments for running `path` as a /bin/sh script, as execvp() does
+// for a file the kernel does not recognise (ENOEXEC).
+static void script_argv(const char *path, char *const argv[], char **sh_argv)
+{
+  sh_argv[0] = (char *)"/bin/sh";
+  sh_argv[1] = (char *)path;
+  size_t i = 1;
+  for (; argv[i] != NULL; i++)
+    sh_argv[i + 1] = argv[i];
+  sh_argv[i + 1] = NULL;
+}
+
+static pid_t spawn_posix(const char *path, char *const argv[], char *const envp[], int in_fd, int out_fd,
+                         const FdMove *moves, int move_count, pid_t pgid)
+{
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t signals;
+  sigemptyset(&signals);
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    sigaddset(&signals, child_default_signals[i]);
+  posix_spawnattr_setsigdefault(&attr, &signals);
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  if (pgid >= 0)
+  {
+    posix_spawnattr_setpgroup(&attr, pgid);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (in_fd != -1)
+    posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  if (out_fd != -1)
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  for (int i = 0; i < move_count; i++)
+  {
+    if (moves[i].from == -1)
+      posix_spawn_file_actions_addclose(&actions, moves[i].to);
+    else
+      posix_spawn_file_actions_adddup2(&actions, moves[i].from, moves[i].to);
+  }
+
+  pid_t pid;
+  int err = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+  if (err == ENOEXEC)
+  {
+    char **sh_argv = malloc((argv_count(argv) + 2) * sizeof(char *));
+    if (sh_argv != NULL)
+    {
+      script_argv(path, argv, sh_argv);
+      err = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh_argv, envp);
+      free(sh_argv);
+    }
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0)
+  {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+static pid_t spawn_fork(const char *path, char *const argv[], char *const envp[], int in_fd, int out_fd,
+                        const FdMove *moves, int move_count, pid_t pgid)
+{
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+
+  prepare_child(pgid);
+  if (in_fd != -1)
+    dup2(in_fd, STDIN_FILENO);
+  if (out_fd != -1)
+    dup2(out_fd, STDOUT_FILENO);
+  for (int i = 0; i < move_count; i++)
+  {
+    if (moves[i].from == -1)
+      close(moves[i].to);
+    else if (dup2(moves[i].from, moves[i].to) == -1)
+      _exit(1);
+  }
+  execve(path, argv, envp);
+  if (errno == ENOEXEC)
+  {
+    // On the stack: malloc() is not safe after fork() in a threaded shell
+    char *sh_argv[argv_count(argv) + 2];
+    script_argv(path, argv, sh_argv);
+    execve("/bin/sh", sh_argv, envp);
+  }
+  _exit(127);
+}
+
+// Start `path` with environment `envp`, stdin/stdout moved to `in_fd` and
+// `out_fd` (-1 to inherit) and `redir` applied on top, in process group
+// `pgid` as for prepare_child(). Every other descriptor the shell holds
+// must be close-on-exec. A file the kernel cannot execute is run with
+// /bin/sh, as execvp() would. Returns -1 with errno set if the program
+// could not be started, or SPAWN_REDIRECT_FAILED.
+pid_t spawn_program(const char *path, char *const argv[], char *const envp[], int in_fd, int out_fd,
+                    const Redirection *redir, pid_t pgid)
+{
+  long long start = trace_begin();
+  FdMove *moves;
+  bool opened = redirect_open(redir, &moves);
+  if (redir->count > 0)
+    trace_end("redirect", start, -1);
+  if (!opened)
+    return SPAWN_REDIRECT_FAILED;
+
+  pid_t pid;
+  if (spawn_method == SPAWN_FORK)
+    pid = spawn_fork(path, argv, envp, in_fd, out_fd, moves, redir->count, pgid);
+  else
+    pid = spawn_posix(path, argv, envp, in_fd, out_fd, moves, redir->count, pgid);
+
+  int saved_errno = errno;
+  redirect_close(moves, redir->count);
+  errno = saved_errno;
+  return pid;
+}
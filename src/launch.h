@@ -0,0 +1,27 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+#include "shell.h"
+
+// Process launch for external commands. posix_spawn (a CLONE_VM|CLONE_VFORK
+// child in glibc) avoids copying the shell's page tables; plain fork+exec
+// is kept for comparison and for SHELL_SPAWN=fork.
+
+typedef enum
+{
+  SPAWN_POSIX,
+  SPAWN_FORK
+} SpawnMethod;
+
+// spawn_program() result when a redirection could not be set up
+#define SPAWN_REDIRECT_FAILED ((pid_t)-2)
+
+extern SpawnMethod spawn_method;
+
+void prepare_child(pid_t pgid);
+pid_t spawn_program(const char *path, char *const argv[], char *const envp[], int in_fd, int out_fd,
+                    const Redirection *redir, pid_t pgid);
+
+#endif
@@ -7,960 +7,708 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <readline/readline.h>
 #include <readline/history.h>
-#include <dirent.h>
 
-#define INPUT_SIZE 1024
-#define MAX_PATH_TOKENS 100
-#define MAX_PATH_LENGTH 512
-#define MAX_ARGS 100
-#define INITIAL_EXEC_CAPACITY 256
+#include "shell.h"
+#include "arena.h"
+#include "cmdhash.h"
+#include "complete.h"
+#include "pathscan.h"
+#include "pathwatch.h"
+#include "launch.h"
+#include "output.h"
+#include "jobs.h"
+#include "script.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "trace.h"
+#include "builtins.h"
+#include "scriptcache.h"
+#include "tree.h"
+#include "vars.h"
 
-char **all_commands = NULL;
+#define MAX_PATH_TOKENS 100
 
-typedef struct
-{
-  char *name;
-  char **args;
-  int arg_count;
-} Command;
+extern char **environ;
 
-typedef enum
-{
-  REDIRECT_NONE,
-  REDIRECT_STDOUT,        // >
-  REDIRECT_STDOUT_APPEND, // >>
-  REDIRECT_STDERR,        // 2>
-  REDIRECT_STDERR_APPEND  // 2>>
-} RedirectionType;
+CompletionIndex command_index = {0};
+bool executables_loaded = false;
+static bool interactive = false;
 
-typedef struct
-{
-  RedirectionType type;
-  char *filepath;
-  int operator_index;
-} Redirection;
+// The directories of PATH that cmdhash searches, split again whenever it
+// changes
+static char *path_dirs[MAX_PATH_TOKENS];
+static int path_dir_count = 0;
+static bool arena_stats = false;
+static FILE *metrics_log = NULL; // SHELL_METRICS
 
 // Function declarations
-void execute_echo(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir);
-void execute_pwd(const Command *cmd, bool isRedirect);
-void execute_cd(const char *target_dir);
-void execute_type(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir);
-void not_found(const char *command);
 void free_path_tokens(char **tokens, int count);
-void free_command(Command *cmd);
-int check_builtin_command(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir);
-int find_command_in_path(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir);
-int parse_command(const char *input, Command *cmd);
-int execute_program(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir, const char *input);
-void print_debug_info(const Command *cmd);
-void execute_command(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir);
-Redirection parse_redirection(const Command *cmd);
+int check_builtin_command(const Command *cmd, FILE *out);
+int find_command_in_path(const Command *cmd, FILE *out);
 char *command_generator(const char *text, int state);
 char **my_completion(const char *text, int start, int end);
-static int is_in_array(char **array, int count, const char *name);
-char **get_executables_from_path();
 
-static int is_in_array(char **array, int count, const char *name)
+void execute_echo(const Command *cmd, int end_index, FILE *out)
 {
-  for (int i = 0; i < count; i++)
+  for (int i = 1; i < end_index; i++)
   {
-    if (strcmp(array[i], name) == 0)
-      return 1;
+    fprintf(out, "%s ", cmd->args[i]);
   }
-  return 0;
+  fprintf(out, "\n");
 }
 
-char **get_executables_from_path()
+void execute_pwd(const Command *cmd, int end_index, FILE *out)
 {
-  const char *path = getenv("PATH");
-  if (!path)
-    return NULL;
-
-  char *path_copy = strdup(path);
-
-  int exec_capacity = INITIAL_EXEC_CAPACITY;
-  int exec_count = 0;
-  char **executables = malloc(exec_capacity * sizeof(char *));
-  if (!executables)
+  char *cwd = getcwd(NULL, 0); // Sized to fit, however deep the directory
+  if (cwd != NULL)
   {
-    free(path_copy);
-    return NULL;
+    fprintf(out, "%s\n", cwd);
+    free(cwd);
   }
+}
 
-  char *saveptr;
-  char *dir_path = strtok_r(path_copy, ":", &saveptr);
-  while (dir_path)
+void execute_cd(const Command *cmd, int end_index, FILE *out)
+{
+  const char *target_dir = end_index > 1 ? cmd->args[1] : NULL;
+  const char *dir = target_dir;
+  if (target_dir == NULL || strcmp(target_dir, "~") == 0)
   {
-    DIR *dir = opendir(dir_path);
-    if (dir)
+    dir = vars_get("HOME");
+    if (dir == NULL)
     {
-      struct dirent *entry;
-      while ((entry = readdir(dir)) != NULL)
-      {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-          continue;
-
-        // Check for duplicates
-        if (is_in_array(executables, exec_count, entry->d_name))
-          continue;
-
-        // Build full path
-        char fullpath[MAX_PATH_LENGTH];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", dir_path, entry->d_name);
-
-        struct stat st;
-        if (stat(fullpath, &st) == 0 && S_ISREG(st.st_mode) &&
-            (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
-        {
-          // Add to array
-          if (exec_count == exec_capacity)
-          {
-            exec_capacity *= 2;
-            char **tmp = realloc(executables, exec_capacity * sizeof(char *));
-            if (!tmp)
-              break;
-            executables = tmp;
-          }
-          executables[exec_count++] = strdup(entry->d_name);
-        }
-      }
-      closedir(dir);
+      return;
     }
-    dir_path = strtok_r(NULL, ":", &saveptr);
   }
-  free(path_copy);
 
-  // Null-terminate the array
-  if (exec_count == exec_capacity)
+  if (chdir(dir) != 0)
   {
-    char **tmp = realloc(executables, (exec_capacity + 1) * sizeof(char *));
-    if (tmp)
-      executables = tmp;
+    fprintf(out, "cd: %s: No such file or directory\n", dir);
+    record_status(1);
   }
-  executables[exec_count] = NULL;
-  return executables;
 }
 
-void execute_echo(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir)
+void execute_type(const Command *cmd, int end_index, FILE *out)
 {
-  int pipeline_index = -1;
-  for (int i = 0; i < cmd->arg_count; i++)
+  if (end_index < 2)
+    return;
+  if (!check_builtin_command(cmd, out))
   {
-    if (strcmp(cmd->args[i], "|") == 0)
+    if (!find_command_in_path(cmd, out))
     {
-      pipeline_index = i;
-      break;
+      fprintf(out, "%s: not found\n", cmd->args[1]);
+      record_status(1);
     }
   }
+}
 
-  if (pipeline_index != -1)
+void execute_hash(const Command *cmd, int end_index, FILE *out)
+{
+  if (end_index == 1)
   {
-    char input[INPUT_SIZE] = {0};
-    for (int i = 1; i < pipeline_index; i++)
-    {
-      strcat(input, cmd->args[i]);
-      strcat(input, " ");
-    }
-    if (strlen(input) > 0 && input[strlen(input) - 1] == ' ')
-    {
-      input[strlen(input) - 1] = '\n';
-      input[strlen(input)] = '\0';
-    }
-
-    Command new_cmd = {0};
-
-    new_cmd.args = malloc(MAX_ARGS * sizeof(char *));
-    new_cmd.arg_count = cmd->arg_count - pipeline_index - 1;
-
-    for (int i = 0; i < new_cmd.arg_count; i++)
-    {
-      new_cmd.args[i] = cmd->args[pipeline_index + i + 1];
-    }
-    new_cmd.args[new_cmd.arg_count] = NULL;
-    new_cmd.name = new_cmd.args[0];
-
-    if (execute_program(&new_cmd, path_tokens, path_count, redir, input))
-    {
-      not_found(cmd->name);
-    }
-
-    return;
+    cmdhash_print(out);
   }
-
-  if (redir->type == REDIRECT_STDOUT)
-    freopen(redir->filepath, "w", stdout);
-  else if (redir->type == REDIRECT_STDOUT_APPEND)
-    freopen(redir->filepath, "a", stdout);
-  else if (redir->type == REDIRECT_STDERR)
-    freopen(redir->filepath, "w", stderr);
-  else if (redir->type == REDIRECT_STDERR_APPEND)
-    freopen(redir->filepath, "a", stderr);
-
-  // Calculate the end index based on whether there's redirection
-  int end_index = redir->type != REDIRECT_NONE ? redir->operator_index : cmd->arg_count;
-
-  for (int i = 1; i < end_index; i++)
+  else if (strcmp(cmd->args[1], "-r") == 0)
   {
-    printf("%s ", cmd->args[i]);
+    cmdhash_reset();
   }
-  printf("\n");
-
-  fflush(stdout);
-  freopen("/dev/tty", "w", stdout);
-}
-
-void execute_pwd(const Command *cmd, bool isRedirect)
-{
-  char cwd[INPUT_SIZE];
-  if (getcwd(cwd, sizeof(cwd)) != NULL)
+  else if (strcmp(cmd->args[1], "-s") == 0)
   {
-    if (isRedirect)
+    unsigned long hits, misses;
+    cmdhash_stats(&hits, &misses);
+    fprintf(out, "hits: %lu\nmisses: %lu\n", hits, misses);
+  }
+  else if (strcmp(cmd->args[1], "-t") == 0)
+  {
+    for (int i = 2; i < end_index; i++)
     {
-      char *filepath = cmd->args[cmd->arg_count - 1];
-      FILE *file = fopen(filepath, "w");
-      if (file == NULL)
+      const char *path = cmdhash_find(cmd->args[i]);
+      if (path == NULL)
       {
-        perror("Error opening file");
-        return;
+        fprintf(stderr, "hash: %s: not found\n", cmd->args[i]);
+        record_status(1);
       }
-      fprintf(file, "%s\n", cwd);
-      fclose(file);
+      else if (end_index > 3)
+        fprintf(out, "%s\t%s\n", cmd->args[i], path);
+      else
+        fprintf(out, "%s\n", path);
     }
-    else
+  }
+  else
+  {
+    for (int i = 1; i < end_index; i++)
     {
-      printf("%s\n", cwd);
+      if (!cmdhash_remember(cmd->args[i]))
+      {
+        fprintf(stderr, "hash: %s: not found\n", cmd->args[i]);
+        record_status(1);
+      }
     }
   }
 }
 
-void execute_cd(const char *target_dir)
+void execute_jobs(const Command *cmd, int end_index, FILE *out)
 {
-  const char *dir = target_dir;
-  if (target_dir == NULL || strcmp(target_dir, "~") == 0)
+  jobs_print(out);
+}
+
+// fg and bg: continue a stopped job in the foreground or the background.
+void execute_fg_bg(const Command *cmd, int end_index, FILE *out)
+{
+  bool foreground = strcmp(cmd->name, "fg") == 0;
+  if (!job_control)
   {
-    dir = getenv("HOME");
-    if (dir == NULL)
-    {
-      return;
-    }
+    fprintf(stderr, "%s: no job control\n", cmd->name);
+    record_status(1);
+    return;
   }
 
-  if (chdir(dir) != 0)
+  const char *spec = end_index > 1 ? cmd->args[1] : NULL;
+  Job *job = job_find(spec);
+  if (job == NULL)
   {
-    printf("cd: %s: No such file or directory\n", dir);
+    fprintf(stderr, "%s: %s: no such job\n", cmd->name, spec != NULL ? spec : "current");
+    record_status(1);
+    return;
   }
-}
 
-void execute_type(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir)
-{
-  if (!check_builtin_command(cmd, path_tokens, path_count, redir))
+  if (!foreground)
   {
-    if (!find_command_in_path(cmd, path_tokens, path_count, redir))
-    {
-      printf("%s: not found\n", cmd->args[1]);
-    }
+    job_resume_background(job);
+    return;
   }
-}
 
-void not_found(const char *command)
-{
-  printf("%s: command not found\n", command);
-}
-
-void free_path_tokens(char **tokens, int count)
-{
-  for (int i = 0; i < count; i++)
+  printf("%s\n", job->command);
+  fflush(stdout);
+  if (job_foreground(job, true, -1))
   {
-    free(tokens[i]);
+    record_status(job->statuses[job->count - 1]);
+    job_free(job);
   }
-}
-
-void free_command(Command *cmd)
-{
-  if (cmd->args != NULL)
+  else
   {
-    for (int i = 0; i < cmd->arg_count; i++)
-    {
-      free(cmd->args[i]);
-    }
-    free(cmd->args);
+    record_status(128 + SIGTSTP);
   }
 }
 
-int check_builtin_command(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir)
+// wait [-n] [%job | pid]...: with no operands, wait for every running
+// job; with -n, for whichever job finishes first.
+void execute_wait(const Command *cmd, int end_index, FILE *out)
 {
-  const char *builtin_commands[] = {"echo", "exit", "type", "pwd", "cd"};
-  const int num_builtins = sizeof(builtin_commands) / sizeof(builtin_commands[0]);
-
-  bool isBuiltin = false;
-
-  int pipeline_index = -1;
-  for (int i = 0; i < cmd->arg_count; i++)
+  if (end_index == 2 && strcmp(cmd->args[1], "-n") == 0)
   {
-    if (strcmp(cmd->args[i], "|") == 0)
-    {
-      pipeline_index = i;
-      break;
-    }
+    int status = job_wait_any();
+    if (status == 128 + SIGINT && jobs_take_interrupt())
+      fprintf(stderr, "\n");
+    record_status(status);
+    return;
   }
 
-  if (pipeline_index != -1)
+  if (end_index == 1)
   {
-    char input[INPUT_SIZE] = {0};
-    for (int i = 0; i < num_builtins; i++)
+    Job *job;
+    while ((job = jobs_next_running()) != NULL)
     {
-      if (strcmp(builtin_commands[i], cmd->args[1]) == 0)
+      if (job_wait(job) == 128 + SIGINT)
       {
-        snprintf(input, INPUT_SIZE, "%s is a shell builtin", cmd->args[1]);
-        isBuiltin = true;
-        break;
+        jobs_take_interrupt();
+        fprintf(stderr, "\n");
+        record_status(128 + SIGINT);
+        return;
       }
     }
-    if (!isBuiltin)
-      return 0;
-
-    for (int i = 1; i < pipeline_index; i++)
-    {
-      strcat(input, cmd->args[i]);
-      strcat(input, " ");
-    }
-    if (strlen(input) > 0 && input[strlen(input) - 1] == ' ')
-      input[strlen(input) - 1] = '\0';
-
-    Command new_cmd = {0};
-
-    new_cmd.args = malloc(MAX_ARGS * sizeof(char *));
-    new_cmd.arg_count = cmd->arg_count - pipeline_index - 1;
-
-    for (int i = 0; i < new_cmd.arg_count; i++)
-    {
-      new_cmd.args[i] = cmd->args[pipeline_index + i + 1];
-    }
-    new_cmd.args[new_cmd.arg_count] = NULL;
-    new_cmd.name = new_cmd.args[0];
-
-    if (execute_program(&new_cmd, path_tokens, path_count, redir, input))
-    {
-      not_found(cmd->name);
-    }
-
-    return 1;
+    return;
   }
 
-  bool isRedirect = (redir->type != REDIRECT_NONE);
-
-  FILE *file = NULL;
-  if (isRedirect)
+  for (int i = 1; i < end_index; i++)
   {
-    char *filepath = cmd->args[cmd->arg_count - 1];
-    file = fopen(filepath, "w");
-    if (file == NULL)
+    const char *spec = cmd->args[i];
+    Job *job = spec[0] == '%' ? job_find(spec) : job_find_pid((pid_t)atoi(spec));
+    if (job == NULL)
     {
-      perror("Error opening file");
-      return 0;
+      fprintf(stderr, "wait: %s: no such job\n", spec);
+      record_status(127);
+      continue;
     }
-  }
-  for (int i = 0; i < num_builtins; i++)
-  {
-    if (strcmp(builtin_commands[i], cmd->args[1]) == 0)
+    int status = job_wait(job);
+    record_status(status);
+    if (status == 128 + SIGINT && jobs_take_interrupt())
     {
-      if (isRedirect)
-        fprintf(file, "%s is a shell builtin\n", cmd->args[1]);
-      else
-        printf("%s is a shell builtin\n", cmd->args[1]);
-      isBuiltin = true;
-      break;
+      fprintf(stderr, "\n");
+      return;
     }
   }
-  if (isRedirect && file != NULL)
-  {
-    fclose(file);
-  }
-  if (isBuiltin)
-    return 1;
-  return 0;
 }
 
-int find_command_in_path(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir)
+// A timeout DURATION: seconds, or a number with an s, m, h or d suffix.
+// Returns -1 if it is not one.
+static long long parse_duration(const char *text)
 {
-  bool isRedirect = (redir->type != REDIRECT_NONE);
-  char fullpath[MAX_PATH_LENGTH];
-  struct stat file_stat;
-  FILE *file = NULL;
-  bool cmdFound = false;
+  char *end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0)
+    return -1;
+
+  double scale = 1000;
+  if (*end == 'm')
+    scale *= 60;
+  else if (*end == 'h')
+    scale *= 60 * 60;
+  else if (*end == 'd')
+    scale *= 24 * 60 * 60;
+  else if (*end != 's' && *end != '\0')
+    return -1;
+  if (*end != '\0' && end[1] != '\0')
+    return -1;
+  return (long long)(value * scale);
+}
 
-  int pipeline_index = -1;
-  for (int i = 0; i < cmd->arg_count; i++)
+// timeout DURATION COMMAND [ARG]...: like coreutils timeout, status 124
+// if COMMAND had to be killed.
+void execute_timeout_builtin(const Command *cmd, int end_index, FILE *out)
+{
+  long long timeout_ms = end_index > 1 ? parse_duration(cmd->args[1]) : -1;
+  if (end_index < 3 || timeout_ms < 0)
   {
-    if (strcmp(cmd->args[i], "|") == 0)
-    {
-      pipeline_index = i;
-      break;
-    }
+    fprintf(stderr, "timeout: usage: timeout DURATION COMMAND [ARG]...\n");
+    record_status(125);
+    return;
   }
 
-  if (pipeline_index != -1)
+  char **argv = malloc((end_index - 1) * sizeof(char *));
+  if (argv == NULL)
   {
-    char input[INPUT_SIZE] = {0};
-    for (int i = 0; i < path_count; i++)
-    {
-      snprintf(fullpath, sizeof(fullpath), "%s/%s", path_tokens[i], cmd->args[1]);
-
-      if (stat(fullpath, &file_stat) == 0)
-      {
-        if (S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR))
-        {
-          snprintf(input, INPUT_SIZE, "%s is %s\n", cmd->args[1], fullpath);
-          cmdFound = true;
-          break;
-        }
-      }
-    }
-
-    if (!cmdFound)
-      return 0;
-
-    Command new_cmd = {0};
-
-    new_cmd.args = malloc(MAX_ARGS * sizeof(char *));
-    new_cmd.arg_count = cmd->arg_count - pipeline_index - 1;
-
-    for (int i = 0; i < new_cmd.arg_count; i++)
-    {
-      new_cmd.args[i] = cmd->args[pipeline_index + i + 1];
-    }
-    new_cmd.args[new_cmd.arg_count] = NULL;
-    new_cmd.name = new_cmd.args[0];
-
-    if (execute_program(&new_cmd, path_tokens, path_count, redir, input))
-    {
-      not_found(cmd->name);
-    }
-    if (cmdFound)
-      return 1;
-    return 0;
+    perror("Memory allocation failed");
+    record_status(125);
+    return;
   }
+  for (int i = 2; i < end_index; i++)
+    argv[i - 2] = cmd->args[i];
+  argv[end_index - 2] = NULL;
+
+  record_status(execute_timeout(argv, timeout_ms, cmd->text));
+  free(argv);
+}
 
-  if (isRedirect)
+// trace [FILE]: without FILE, per-phase totals of the trace so far; with
+// it, write the trace to FILE as Chrome trace-event JSON right away.
+void execute_trace(const Command *cmd, int end_index, FILE *out)
+{
+  if (!tracing)
   {
-    char *filepath = cmd->args[cmd->arg_count - 1];
-    file = fopen(filepath, "w");
-    if (file == NULL)
-    {
-      perror("Error opening file");
-      return 0;
-    }
+    fprintf(stderr, "trace: tracing is off; start the shell with SHELL_TRACE=FILE\n");
+    record_status(1);
   }
-
-  for (int i = 0; i < path_count; i++)
+  else if (end_index > 1)
   {
-    snprintf(fullpath, sizeof(fullpath), "%s/%s", path_tokens[i], cmd->args[1]);
-
-    if (stat(fullpath, &file_stat) == 0)
-    {
-      if (S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR))
-      {
-        if (isRedirect)
-          fprintf(file, "%s is %s\n", cmd->args[1], fullpath);
-        else
-          printf("%s is %s\n", cmd->args[1], fullpath);
-        cmdFound = true;
-        break;
-      }
-    }
+    if (!trace_dump(cmd->args[1]))
+      record_status(1);
   }
-
-  if (isRedirect && file != NULL)
+  else
   {
-    fclose(file);
+    trace_summary(out);
   }
+}
 
-  if (cmdFound)
-    return 1;
-  return 0;
+void execute_parallel_builtin(const Command *cmd, int end_index, FILE *out)
+{
+  record_status(execute_parallel(cmd->args, end_index));
 }
 
-int parse_command(const char *input, Command *cmd)
+bool is_builtin(const char *name)
 {
-  char *input_copy = strdup(input);
-  if (input_copy == NULL)
-  {
-    perror("Memory allocation failed");
-    return 0;
-  }
+  return find_builtin(name) != NULL;
+}
+
+void not_found(const char *command)
+{
+  printf("%s: command not found\n", command);
+}
 
-  cmd->args = malloc(MAX_ARGS * sizeof(char *));
-  if (cmd->args == NULL)
+void free_path_tokens(char **tokens, int count)
+{
+  for (int i = 0; i < count; i++)
   {
-    perror("Memory allocation failed");
-    free(input_copy);
-    return 0;
+    free(tokens[i]);
   }
+}
 
-  cmd->arg_count = 0;
-  char *current = input_copy;
-
-  while (*current && cmd->arg_count < MAX_ARGS)
-  {
-    while (*current == ' ')
-      current++;
-    if (!*current)
-      break;
+int check_builtin_command(const Command *cmd, FILE *out)
+{
+  if (!is_builtin(cmd->args[1]))
+    return 0;
+  fprintf(out, "%s is a shell builtin\n", cmd->args[1]);
+  return 1;
+}
 
-    char *start = current;
-    char *arg_start = current;
-    char quote = '\'';
-    int in_quotes = 0;
+int find_command_in_path(const Command *cmd, FILE *out)
+{
+  const char *fullpath = cmdhash_lookup(cmd->args[1]);
+  if (fullpath == NULL)
+    return 0;
 
-    while (*current && (*current != ' ' || in_quotes))
-    {
-      if ((*current == '\'' || *current == '\"') && !in_quotes)
-      {
-        quote = *current;
-      }
+  fprintf(out, "%s is %s\n", cmd->args[1], fullpath);
+  return 1;
+}
 
-      if (*current == quote)
-      {
-        if (!in_quotes)
-        {
-          // Start: quoted string
-          in_quotes = 1;
-          memmove(current, current + 1, strlen(current));
-        }
-        else
-        {
-          // End: quoted string
-          in_quotes = 0;
-          memmove(current, current + 1, strlen(current));
-        }
-      }
-      else
-      {
-        if (*current == '\\')
-        {
-          if (!in_quotes)
-          {
-            memmove(current, current + 1, strlen(current));
-          }
-          else if (quote == '\"' && (*(current + 1) == '\\' || *(current + 1) == '\"'))
-          {
-            memmove(current, current + 1, strlen(current));
-          }
-        }
-        current++;
-      }
-    }
+// Throw away everything learned from PATH and scan it again in the
+// background, for when inotify can no longer vouch for the caches.
+static void rescan_executables(void)
+{
+  completion_index_drop_source(&command_index, COMPLETE_EXECUTABLE);
+  cmdhash_reset();
+  executables_loaded = false;
+  start_executable_scan(vars_get("PATH"));
+}
 
-    if (*current)
-    {
-      *current = '\0';
-      current++;
-    }
+// Split `path` at colons into `dirs`, at most MAX_PATH_TOKENS of them.
+// Returns how many there are.
+static int split_path(const char *path, char **dirs)
+{
+  char *path_copy = path != NULL ? strdup(path) : NULL;
+  if (path_copy == NULL)
+    return 0;
 
-    cmd->args[cmd->arg_count] = strdup(arg_start);
-    if (cmd->args[cmd->arg_count] == NULL)
+  int count = 0;
+  char *saveptr;
+  char *token = strtok_r(path_copy, ":", &saveptr);
+  while (token != NULL && count < MAX_PATH_TOKENS)
+  {
+    if ((dirs[count] = strdup(token)) == NULL)
     {
       perror("Memory allocation failed");
-      free_command(cmd);
-      free(input_copy);
-      return 0;
+      break;
     }
-    cmd->arg_count++;
+    count++;
+    token = strtok_r(NULL, ":", &saveptr);
   }
-
-  cmd->args[cmd->arg_count] = NULL;
-  cmd->name = cmd->args[0];
-  free(input_copy);
-  return 1;
+  free(path_copy);
+  return count;
 }
 
-int execute_program(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir, const char *input)
+// PATH has been given a new value, or unset (NULL). What was learned
+// about the old directories is invalidated here, once for the change:
+// the whole command cache, or in the REPL only the names in directories
+// that came or went, along with their completions and inotify watches.
+void path_changed(const char *path)
 {
-  int pipeline_index = -1;
-  for (int i = 0; i < cmd->arg_count; i++)
-  {
-    if (strcmp(cmd->args[i], "|") == 0)
-    {
-      pipeline_index = i;
-      break;
-    }
-  }
+  free_path_tokens(path_dirs, path_dir_count);
+  path_dir_count = split_path(path, path_dirs);
+  cmdhash_set_path(path_dirs, path_dir_count);
+  if (!interactive)
+    cmdhash_reset();
+  else if (!pathwatch_set_path(path_dirs, path_dir_count, &command_index))
+    rescan_executables();
+}
 
-  int pipefds[2];
-  // No pipeline: just handle redirection and exec
-  if (pipeline_index == -1)
+// Pick up the background PATH scan once it is available, then apply any
+// changes inotify has seen since. Only completion blocks on the scan; the
+// REPL just checks between commands.
+static void load_executable_index(bool block)
+{
+  if (!executables_loaded)
   {
-    if (input != NULL)
-    {
-      pipe(pipefds);
-    }
-
-    pid_t pid = fork();
-    if (pid == 0)
-    {
-      // Child process
-      if (redir->type != REDIRECT_NONE)
-      {
-        char *filepath = redir->filepath;
-        int new_arg_count = 0;
-        char **new_args = malloc((cmd->arg_count + 1) * sizeof(char *));
-
-        if (new_args == NULL)
-        {
-          perror("Memory allocation failed");
-          exit(1);
-        }
-
-        // Copy arguments until redirection operator
-        for (int i = 0; i < redir->operator_index; i++)
-        {
-          new_args[new_arg_count++] = cmd->args[i];
-        }
-        new_args[new_arg_count] = NULL;
-
-        if (filepath != NULL)
-        {
-          int flags = O_WRONLY | O_CREAT;
-          if (redir->type == REDIRECT_STDOUT || redir->type == REDIRECT_STDERR)
-            flags |= O_TRUNC;
-          else
-            flags |= O_APPEND;
-
-          int fd = open(filepath, flags, 0644);
-          if (fd == -1)
-          {
-            perror("Error opening file");
-            free(new_args);
-            exit(1);
-          }
-          int target_fd = (redir->type == REDIRECT_STDOUT || redir->type == REDIRECT_STDOUT_APPEND) ? STDOUT_FILENO : STDERR_FILENO;
-          if (dup2(fd, target_fd) == -1)
-          {
-            perror("Error redirecting output");
-            close(fd);
-            free(new_args);
-            exit(1);
-          }
-          close(fd);
-        }
-
-        // Execute the program with modified arguments
-        execvp(cmd->name, new_args);
-        free(new_args);
-        exit(127);
-      }
-      else
-      {
-        if (input != NULL)
-        {
-          close(pipefds[1]);              // Close write end
-          dup2(pipefds[0], STDIN_FILENO); // Redirect stdin to read end
-          close(pipefds[0]);
-
-          execvp(cmd->name, cmd->args);
-          perror("execvp failed");
-          exit(1);
-        }
-        else
-        {
-          execvp(cmd->name, cmd->args);
-          exit(127);
-        }
-      }
-    }
-    else if (pid > 0)
-    {
-      if (input != NULL)
-      {
-        close(pipefds[0]); // Close read end
-
-        // Write input to less
-        write(pipefds[1], input, strlen(input));
-        close(pipefds[1]); // Close write end to signal EOF
-      }
-      // Parent process
-      int status;
-      wait(&status);
-      if (WIFEXITED(status))
-      {
-        int exit_status = WEXITSTATUS(status);
-        if (exit_status == 127)
-        {
-          return 1; // Command not found
-        }
-        return 0; // Command found, but failed
-      }
-    }
-    return 1;
+    char **executables = block ? wait_executable_scan() : poll_executable_scan();
+    if (!executables)
+      return;
+    completion_index_merge(&command_index, executables, COMPLETE_EXECUTABLE);
+    executables_loaded = true;
+    if (getenv("SHELL_SCAN_STATS") != NULL)
+      print_scan_stats(stderr);
   }
 
-  // Pipeline: cmd1 | cmd2
-  if (pipe(pipefds) == -1)
+  if (!pathwatch_process(&command_index))
   {
-    perror("Pipe failed");
-    return 1;
+    rescan_executables();
+    if (block)
+      load_executable_index(true);
   }
+}
 
-  char *args1[pipeline_index + 1];
-  for (int i = 0; i < pipeline_index; i++)
-    args1[i] = cmd->args[i];
-  args1[pipeline_index] = NULL;
-
-  int args2_count = cmd->arg_count - pipeline_index - 1;
-  char *args2[args2_count + 1];
-  for (int i = 0; i < args2_count; i++)
-    args2[i] = cmd->args[pipeline_index + 1 + i];
-  args2[args2_count] = NULL;
+char *command_generator(const char *text, int state)
+{
+  if (state == 0)
+    load_executable_index(true);
+  return completion_index_next(&command_index, text, state);
+}
 
-  pid_t pid1 = fork();
-  if (pid1 == 0)
-  {
-    // First child: left side of pipe
-    close(pipefds[0]);               // Close unused read end
-    dup2(pipefds[1], STDOUT_FILENO); // Redirect stdout to pipe
-    close(pipefds[1]);
-    execvp(args1[0], args1);
-    perror("execvp (left) failed");
-    exit(127);
-  }
+char **my_completion(const char *text, int start, int end)
+{
+  rl_attempted_completion_over = 1;
+  return rl_completion_matches(text, command_generator);
+}
 
-  pid_t pid2 = fork();
-  if (pid2 == 0)
+// Run a builtin other than exit with its output collected and written
+// once, under its redirection.
+static void run_builtin(const Builtin *builtin, const Command *cmd, const Redirection *redir)
+{
+  long long start = trace_begin();
+  Output output;
+  if (!output_open(&output, redir))
   {
-    // Second child: right side of pipe
-    close(pipefds[1]);              // Close unused write end
-    dup2(pipefds[0], STDIN_FILENO); // Redirect stdin to pipe
-    close(pipefds[0]);
-
-    if (strcmp(args2[0], "type") == 0)
-    {
-      Command builtin_cmd = {.name = args2[0], .args = args2, .arg_count = args2_count};
-      Redirection dummy_redir = {REDIRECT_NONE, NULL, -1};
-      execute_type(&builtin_cmd, path_tokens, path_count, &dummy_redir);
-      exit(0);
-    }
-
-    execvp(args2[0], args2);
-    perror("execvp (right) failed");
-    exit(127);
+    record_status(1);
+    return;
   }
 
-  // Parent process
-  close(pipefds[0]);
-  close(pipefds[1]);
+  int end_index = redir->operator_index != -1 ? redir->operator_index : cmd->arg_count;
+  builtin->run(cmd, end_index, output.stream);
 
-  int status1, status2;
-  waitpid(pid1, &status1, 0);
-  waitpid(pid2, &status2, 0);
+  if (!output_close(&output) && last_status == 0)
+    record_status(1);
+  trace_end("builtin", start, -1);
+}
 
-  // Return 1 if either side of the pipe was not found (exit code 127), else 0
-  if ((WIFEXITED(status1) && WEXITSTATUS(status1) == 127) ||
-      (WIFEXITED(status2) && WEXITSTATUS(status2) == 127))
+// The status `exit [N]` leaves with: N modulo 256, $? without it, and 2
+// if N is not a number. Returns -1, not exiting, for more than one N.
+static int exit_status(const Command *cmd, int end_index)
+{
+  if (end_index < 2)
+    return last_status;
+  if (end_index > 2)
   {
-    return 1;
+    fprintf(stderr, "exit: too many arguments\n");
+    return -1;
   }
-  return 0;
-}
 
-void print_debug_info(const Command *cmd)
-{
-  printf("CMD: %s\n", cmd->name);
-  printf("ARGS: |");
-  for (int i = 0; i < cmd->arg_count; i++)
+  const char *text = cmd->args[1];
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE)
   {
-    printf(" %s |", cmd->args[i]);
+    fprintf(stderr, "exit: %s: numeric argument required\n", text);
+    return 2;
   }
-  printf("\n");
+  return (int)(value & 0xff);
 }
 
-Redirection parse_redirection(const Command *cmd)
+void execute_command(const Command *cmd, const Redirection *redir, Arena *arena)
 {
-  Redirection redir = {REDIRECT_NONE, NULL, -1};
-  for (int i = 0; i < cmd->arg_count; i++)
+  int end_index = redir->operator_index != -1 ? redir->operator_index : cmd->arg_count;
+  const Builtin *builtin = find_builtin_for(cmd, end_index);
+
+  if (builtin != NULL && builtin->run == NULL) // exit
   {
-    if (strcmp(cmd->args[i], ">") == 0 || strcmp(cmd->args[i], "1>") == 0)
+    int status = exit_status(cmd, end_index);
+    if (status == -1)
     {
-      redir.type = REDIRECT_STDOUT;
-      redir.operator_index = i;
-      break;
-    }
-    else if (strcmp(cmd->args[i], "2>") == 0)
-    {
-      redir.type = REDIRECT_STDERR;
-      redir.operator_index = i;
-      break;
-    }
-    else if (strcmp(cmd->args[i], "1>>") == 0 || strcmp(cmd->args[i], ">>") == 0)
-    {
-      redir.type = REDIRECT_STDOUT_APPEND;
-      redir.operator_index = i;
-      break;
-    }
-    else if (strcmp(cmd->args[i], "2>>") == 0)
-    {
-      redir.type = REDIRECT_STDERR_APPEND;
-      redir.operator_index = i;
-      break;
+      record_status(1);
+      return;
     }
+    arena_free(arena);
+    free_path_tokens(path_dirs, path_dir_count);
+    cmdhash_reset();
+    exit(status);
   }
 
-  if (redir.type != REDIRECT_NONE)
+  if (builtin != NULL)
+  {
+    record_status(0); // Builtins override this when they fail
+    run_builtin(builtin, cmd, redir);
+  }
+  else
   {
-    if (redir.operator_index + 1 < cmd->arg_count)
+    if (execute_program(cmd, redir, arena))
     {
-      redir.filepath = cmd->args[redir.operator_index + 1];
+      not_found(cmd->name);
     }
   }
-
-  return redir;
 }
 
-char *command_generator(const char *text, int state)
+// Parse and run one command, a line or several. The text, the parsed
+// command and everything executing it allocates come from `arena`, which
+// is reset before returning.
+void execute_line(const char *line, size_t length, Arena *arena)
 {
-  static int list_index;
-  static int exec_index;
-  static int mode; // 0 = builtins, 1 = executables
-  static const char *builtins[] = {"echo", "exit", "type", "pwd", "cd", NULL};
-
-  if (state == 0)
+  char *input = arena_alloc(arena, length + 1);
+  if (input == NULL)
   {
-    list_index = 0;
-    exec_index = 0;
-    mode = 0;
+    perror("Memory allocation failed");
+    return;
   }
+  memcpy(input, line, length);
+  input[length] = '\0';
+
+  long long start = trace_begin();
+  Command *cmd = parse_command(input, arena);
+  trace_end("parse", start, -1);
+  if (cmd == NULL)
+    record_status(2);
+  execute_parsed(cmd, arena);
+}
+
+// Run a command parse_command() returned, NULL after a syntax error, then
+// reset `arena`. Its tree is built once here; a loop in it runs that tree
+// again on every pass.
+void execute_parsed(Command *cmd, Arena *arena)
+{
+  long long line_start = trace_begin();
+  jobs_reap();
 
-  if (mode == 0)
+  Node *tree = NULL;
+  if (cmd != NULL)
   {
-    while (builtins[list_index])
+    long long start = trace_begin();
+    if (!parse_tree(cmd, &tree, arena))
     {
-      const char *cmd = builtins[list_index++];
-      if (strncmp(cmd, text, strlen(text)) == 0)
-      {
-        return strdup(cmd);
-      }
+      record_status(2);
+      tree = NULL;
     }
-    mode = 1;
+    trace_end("parse_tree", start, -1);
   }
+  bool measured = metrics_log != NULL && tree != NULL;
+  MetricsSpan span;
+  if (measured)
+    metrics_begin(&span);
+
+  execute_tree(tree, arena);
 
-  if (mode == 1 && all_commands)
+  trace_end("line", line_start, -1);
+  if (measured)
   {
-    while (all_commands[exec_index])
-    {
-      const char *cmd = all_commands[exec_index++];
-      if (strncmp(cmd, text, strlen(text)) == 0)
-        return strdup(cmd);
-    }
+    Metrics metrics;
+    metrics_end(&span, &metrics);
+    log_metrics(metrics_log, &metrics, last_status, cmd->text);
   }
-
-  return NULL;
+  if (arena_stats)
+    print_arena_stats(stderr, arena);
+  arena_reset(arena);
 }
 
-char **my_completion(const char *text, int start, int end)
+// ^C at the prompt: drop the line being edited and start on a fresh one.
+static int discard_interrupted_line(void)
 {
-  rl_attempted_completion_over = 1;
-  return rl_completion_matches(text, command_generator);
+  if (jobs_take_interrupt())
+  {
+    rl_crlf();
+    rl_replace_line("", 0);
+    rl_on_new_line();
+    rl_redisplay();
+  }
+  return 0;
 }
 
-void execute_command(const Command *cmd, char **path_tokens, int path_count, const Redirection *redir)
+// Read the rest of the command `line` starts at "> " prompts and append
+// it: the bodies of the here-documents it opens, the lines up to the end
+// of an if or loop, or the line after a trailing |, && or ||. Returns the
+// (possibly reallocated) line; at EOF what was read so far is kept and
+// the parser complains about what is missing.
+static char *read_continuation_lines(char *line, Arena *arena)
 {
-  bool isRedirect = redir->type == REDIRECT_STDOUT;
-  if (strcmp(cmd->name, "exit") == 0)
-  {
-    free_command((Command *)cmd);
-    free_path_tokens(path_tokens, path_count);
-    exit(0);
-  }
-  else if (strcmp(cmd->name, "echo") == 0)
-  {
-    execute_echo(cmd, path_tokens, path_count, redir);
-  }
-  else if (strcmp(cmd->name, "pwd") == 0)
-  {
-    execute_pwd(cmd, isRedirect);
-  }
-  else if (strcmp(cmd->name, "cd") == 0)
-  {
-    execute_cd(cmd->arg_count > 1 ? cmd->args[1] : NULL);
-  }
-  else if (strcmp(cmd->name, "type") == 0 && cmd->arg_count > 1)
-  {
-    execute_type(cmd, path_tokens, path_count, redir);
-  }
-  else
+  size_t length = strlen(line);
+  while (command_extent(line, length, arena) == 0)
   {
-    if (execute_program(cmd, path_tokens, path_count, redir, NULL))
+    char *next = readline("> ");
+    if (next == NULL)
+      break;
+    size_t next_length = strlen(next);
+    char *tmp = realloc(line, length + next_length + 2);
+    if (tmp == NULL)
     {
-      not_found(cmd->name);
+      perror("Memory allocation failed");
+      free(next);
+      break;
     }
+    line = tmp;
+    line[length++] = '\n';
+    memcpy(line + length, next, next_length + 1);
+    length += next_length;
+    free(next);
   }
+  arena_reset(arena);
+  return line;
 }
 
-int main(int argc, char *argv[])
+// The readline REPL, with completion kept up to date in the background.
+static void run_interactive(Arena *arena)
 {
-  setbuf(stdout, NULL); // Flush after every printf
   rl_attempted_completion_function = my_completion;
   rl_bind_key('\t', rl_complete);
-  all_commands = get_executables_from_path();
+  jobs_init(true);
+  rl_signal_event_hook = discard_interrupted_line;
 
-  char *path_tokens[MAX_PATH_TOKENS];
-  int path_count = 0;
+  for (const Builtin *builtin = builtin_table; builtin->name != NULL; builtin++)
+    completion_index_add(&command_index, builtin->name, COMPLETE_BUILTIN);
+  // Watch before scanning so nothing installed during the scan is missed
+  pathwatch_start(path_dirs, path_dir_count);
+  start_executable_scan(vars_get("PATH"));
+  interactive = true;
 
-  // Get PATH environment variable
-  const char *path = getenv("PATH");
-  if (path == NULL)
+  char *input;
+  while (true)
   {
-    fprintf(stderr, "PATH environment variable not set\n");
-    return 1;
+    load_executable_index(false);
+    jobs_notify();
+    if ((input = readline("$ ")) == NULL)
+      break;
+    input = read_continuation_lines(input, arena);
+
+    if (*input)
+      add_history(input);
+
+    execute_line(input, strlen(input), arena);
+    free(input);
   }
 
-  // Tokenize PATH
-  char *path_copy = strdup(path);
-  if (path_copy == NULL)
+  pathwatch_stop();
+  completion_index_free(&command_index);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *spawn_env = getenv("SHELL_SPAWN");
+  if (spawn_env != NULL && strcmp(spawn_env, "fork") == 0)
+    spawn_method = SPAWN_FORK;
+  batch_args = getenv("SHELL_ARG_BATCH") != NULL;
+  arena_stats = getenv("SHELL_ARENA_STATS") != NULL;
+  const char *trace_path = getenv("SHELL_TRACE");
+  if (trace_path != NULL)
+    trace_init(trace_path);
+  const char *metrics_path = getenv("SHELL_METRICS");
+  if (metrics_path != NULL && (metrics_log = fopen(metrics_path, "ae")) == NULL)
+    perror(metrics_path);
+
+  // Taking in PATH splits it into path_dirs
+  vars_init(environ);
+  if (vars_get("PATH") == NULL)
   {
-    perror("Memory allocation failed");
+    fprintf(stderr, "PATH environment variable not set\n");
     return 1;
   }
 
-  char *saveptr;
-  char *token = strtok_r(path_copy, ":", &saveptr);
-  while (token != NULL && path_count < MAX_PATH_TOKENS)
+  Arena line_arena = {0};
+  int status = 0;
+  jobs_init(false); // run_interactive() takes the terminal as well
+  if (argc > 1 && strcmp(argv[1], "-c") == 0)
   {
-    path_tokens[path_count] = strdup(token);
-    if (path_tokens[path_count] == NULL)
+    if (argc > 2)
     {
-      perror("Memory allocation failed");
-      free_path_tokens(path_tokens, path_count);
-      free(path_copy);
-      return 1;
+      run_script_string(argv[2], &line_arena);
     }
-    path_count++;
-    token = strtok_r(NULL, ":", &saveptr);
-  }
-  free(path_copy);
-
-  char *input;
-  while ((input = readline("$ ")) != NULL)
-  {
-    if (*input)
-      add_history(input);
-
-    Command cmd = {0};
-    if (!parse_command(input, &cmd))
+    else
     {
-      continue;
+      fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+      status = 2;
     }
-    // print_debug_info(&cmd);
-
-    Redirection redir = parse_redirection(&cmd);
-    execute_command(&cmd, path_tokens, path_count, &redir);
-    free_command(&cmd);
-    free(input);
+  }
+  else if (argc > 1)
+  {
+    script_cache_init();
+    status = run_script_file(argv[1], &line_arena);
+  }
+  else if (!isatty(STDIN_FILENO))
+  {
+    run_script_fd(STDIN_FILENO, &line_arena);
+  }
+  else
+  {
+    run_interactive(&line_arena);
   }
 
-  free_path_tokens(path_tokens, path_count);
-  free(all_commands);
-  return 0;
+  arena_free(&line_arena);
+  free_path_tokens(path_dirs, path_dir_count);
+  cmdhash_reset();
+  return status != 0 ? status : last_status;
 }
@@ -0,0 +1,100 @@
+#include "metrics.h"
+
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+
+static struct rusage children_total; // Every child that terminated, summed
+static long peak_rss_kb = 0;         // Largest child since the innermost metrics_begin()
+static unsigned long reaped = 0;
+
+static long long timeval_us(struct timeval tv)
+{
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static long long now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// waitpid() that also collects the usage of a child that terminated. A
+// stop is not counted: wait4() then reports the usage so far, which the
+// eventual exit reports again.
+pid_t wait_child(pid_t pid, int *status, int options)
+{
+  struct rusage usage;
+  pid_t result = wait4(pid, status, options, &usage);
+  if (result > 0 && (WIFEXITED(*status) || WIFSIGNALED(*status)))
+  {
+    timeradd(&children_total.ru_utime, &usage.ru_utime, &children_total.ru_utime);
+    timeradd(&children_total.ru_stime, &usage.ru_stime, &children_total.ru_stime);
+    children_total.ru_nvcsw += usage.ru_nvcsw;
+    children_total.ru_nivcsw += usage.ru_nivcsw;
+    if (usage.ru_maxrss > peak_rss_kb)
+      peak_rss_kb = usage.ru_maxrss;
+    reaped++;
+  }
+  return result;
+}
+
+void metrics_begin(MetricsSpan *span)
+{
+  span->start_us = now_us();
+  getrusage(RUSAGE_SELF, &span->self);
+  span->children = children_total;
+  span->saved_peak_kb = peak_rss_kb;
+  span->saved_reaped = reaped;
+  peak_rss_kb = 0;
+}
+
+// Spans nest: the peak is handed back to an enclosing one on the way out.
+void metrics_end(MetricsSpan *span, Metrics *result)
+{
+  struct rusage self;
+  getrusage(RUSAGE_SELF, &self);
+
+  result->wall_us = now_us() - span->start_us;
+  result->user_us = timeval_us(self.ru_utime) - timeval_us(span->self.ru_utime) +
+                    timeval_us(children_total.ru_utime) - timeval_us(span->children.ru_utime);
+  result->sys_us = timeval_us(self.ru_stime) - timeval_us(span->self.ru_stime) +
+                   timeval_us(children_total.ru_stime) - timeval_us(span->children.ru_stime);
+  result->voluntary_switches = self.ru_nvcsw - span->self.ru_nvcsw +
+                               children_total.ru_nvcsw - span->children.ru_nvcsw;
+  result->involuntary_switches = self.ru_nivcsw - span->self.ru_nivcsw +
+                                 children_total.ru_nivcsw - span->children.ru_nivcsw;
+  result->max_rss_kb = reaped != span->saved_reaped ? peak_rss_kb : self.ru_maxrss;
+
+  if (span->saved_peak_kb > peak_rss_kb)
+    peak_rss_kb = span->saved_peak_kb;
+}
+
+static void print_seconds(FILE *out, const char *label, long long us)
+{
+  fprintf(out, "%s\t%lldm%lld.%03llds\n", label, us / 60000000, us / 1000000 % 60, us / 1000 % 1000);
+}
+
+// The report of the `time` keyword, in bash's format plus two lines.
+void print_time(FILE *out, const Metrics *metrics)
+{
+  fprintf(out, "\n");
+  print_seconds(out, "real", metrics->wall_us);
+  print_seconds(out, "user", metrics->user_us);
+  print_seconds(out, "sys", metrics->sys_us);
+  fprintf(out, "maxrss\t%ld KB\n", metrics->max_rss_kb);
+  fprintf(out, "ctxsw\t%ld voluntary, %ld involuntary\n", metrics->voluntary_switches,
+          metrics->involuntary_switches);
+}
+
+// One tab-separated line per command for SHELL_METRICS: when it finished
+// (Unix time), wall, user and sys milliseconds, peak RSS in KB, voluntary
+// and involuntary context switches, exit status and the command line.
+void log_metrics(FILE *log, const Metrics *metrics, int status, const char *command)
+{
+  fprintf(log, "%lld\t%.3f\t%.3f\t%.3f\t%ld\t%ld\t%ld\t%d\t%s\n", (long long)time(NULL),
+          metrics->wall_us / 1000.0, metrics->user_us / 1000.0, metrics->sys_us / 1000.0, metrics->max_rss_kb,
+          metrics->voluntary_switches, metrics->involuntary_switches, status, command);
+  fflush(log);
+}
@@ -0,0 +1,39 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// Resource accounting for the `time` keyword and SHELL_METRICS. Every wait
+// for a child goes through wait_child(), which uses wait4() and adds the
+// usage of each child that terminates to a running total. A measurement
+// is the difference between two snapshots of that total, plus what the
+// shell itself used in between (builtins run in the shell).
+
+typedef struct
+{
+  long long wall_us;
+  long long user_us;
+  long long sys_us;
+  long max_rss_kb; // Largest child, or the shell if no child ran
+  long voluntary_switches;
+  long involuntary_switches;
+} Metrics;
+
+typedef struct
+{
+  long long start_us;
+  struct rusage self;
+  struct rusage children;
+  long saved_peak_kb;
+  unsigned long saved_reaped;
+} MetricsSpan;
+
+pid_t wait_child(pid_t pid, int *status, int options);
+void metrics_begin(MetricsSpan *span);
+void metrics_end(MetricsSpan *span, Metrics *result);
+void print_time(FILE *out, const Metrics *metrics);
+void log_metrics(FILE *log, const Metrics *metrics, int status, const char *command);
+
+#endif
@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Returns false if the data could not all be written (reported unless
+// the reader went away).
+bool write_all(int fd, const char *data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = write(fd, data, size);
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EPIPE)
+        perror("write");
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Start collecting a builtin's output, with `redir` in effect. Returns
+// false, having reported why, if a redirection cannot be set up.
+bool output_open(Output *out, const Redirection *redir)
+{
+  out->data = NULL;
+  out->size = 0;
+  out->saved_count = 0;
+  out->stream = open_memstream(&out->data, &out->size);
+  if (out->stream == NULL)
+  {
+    perror("open_memstream");
+    return false;
+  }
+
+  FdMove *moves;
+  bool ok = redirect_open(redir, &moves);
+  if (ok)
+  {
+    ok = redirect_apply(moves, redir->count, out->saved, &out->saved_count);
+    redirect_close(moves, redir->count);
+    if (!ok)
+      redirect_restore(out->saved, out->saved_count);
+  }
+  if (!ok)
+  {
+    fclose(out->stream);
+    free(out->data);
+  }
+  return ok;
+}
+
+// Write everything collected so far in one go, then undo the redirections.
+// Returns false if the output could not be written.
+bool output_close(Output *out)
+{
+  fclose(out->stream);
+  bool written = write_all(STDOUT_FILENO, out->data, out->size);
+  free(out->data);
+  redirect_restore(out->saved, out->saved_count);
+  return written;
+}
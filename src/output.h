@@ -0,0 +1,28 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "redirect.h"
+#include "shell.h"
+
+// Output of one builtin. Everything written to `stream` is collected in
+// memory and written to fd 1 in a single pass by output_close(). The
+// builtin's redirections are applied to the shell's own descriptors for
+// its duration and the saved ones restored afterwards, so files, pipes,
+// here-documents and the terminal all behave the same.
+typedef struct
+{
+  FILE *stream;
+  char *data;
+  size_t size;
+  SavedFd saved[REDIRECT_SAVED_MAX]; // Descriptors the redirections replaced
+  int saved_count;
+} Output;
+
+bool output_open(Output *out, const Redirection *redir);
+bool output_close(Output *out);
+bool write_all(int fd, const char *data, size_t size);
+
+#endif
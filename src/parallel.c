@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "cmdhash.h"
+#include "events.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "launch.h"
+#include "output.h"
+#include "script.h"
+#include "shell.h"
+#include "vars.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Failed jobs are counted in the exit status up to this, as GNU parallel does
+#define MAX_FAILURES 101
+
+// Bytes of stdin read at a time
+#define INPUT_BLOCK_SIZE 65536
+
+typedef struct
+{
+  pid_t pid;
+  int pidfd;  // -1 if its exit has to be found after a SIGCHLD
+  int output; // memfd holding the job's stdout, -1 if it never started
+  long seq;   // Position of its input
+  int status;
+} Task;
+
+typedef struct
+{
+  char **template; // COMMAND [ARG]...
+  int template_count;
+  bool has_placeholder;
+  char **list; // Inputs after ":::", NULL to read lines from stdin
+  int list_count;
+  int next;
+  char *input; // Lines read from stdin; the next starts at input_start
+  size_t input_start;
+  size_t input_size;
+  size_t input_capacity;
+  bool input_done; // Stdin is at its end
+  int in_fd; // Children's stdin
+  int max_jobs;
+  bool keep_order;
+
+  Task *running;
+  int running_count;
+  Task *finished; // -k only: done, but an earlier job is still running
+  int finished_count;
+  int finished_capacity;
+  long started;
+  long next_output; // -k only: seq of the job to write next
+  int failures;
+  bool stop; // Start no more jobs
+  bool interrupted;
+} Parallel;
+
+// Make room for at least `more` bytes and a terminator after the input
+// held. Returns false if there is no memory.
+static bool reserve_input(Parallel *p, size_t more)
+{
+  if (p->input_size + more < p->input_capacity)
+    return true;
+  size_t capacity = p->input_capacity * 2 + more + INPUT_BLOCK_SIZE;
+  char *input = realloc(p->input, capacity);
+  if (input == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+  p->input = input;
+  p->input_capacity = capacity;
+  return true;
+}
+
+// The next input: a word after ":::", or a line of stdin. Stdin is read
+// from fd 0 directly in blocks, not through stdio, so nothing of it is
+// left in a FILE buffer for the next command to miss; reading to the
+// end, as parallel does, leaves nothing behind either.
+static const char *next_input(Parallel *p)
+{
+  if (p->list != NULL)
+    return p->next < p->list_count ? p->list[p->next++] : NULL;
+
+  while (true)
+  {
+    char *line = p->input + p->input_start;
+    size_t held = p->input_size - p->input_start;
+    char *newline = held > 0 ? memchr(line, '\n', held) : NULL;
+    if (newline != NULL || (p->input_done && held > 0))
+    {
+      char *end = newline != NULL ? newline : line + held;
+      *end = '\0';
+      p->input_start = end - p->input + (newline != NULL);
+      return line;
+    }
+    if (p->input_done)
+      return NULL;
+
+    // Keep the partial line and read more after it
+    memmove(p->input, line, held);
+    p->input_start = 0;
+    p->input_size = held;
+    if (!reserve_input(p, INPUT_BLOCK_SIZE))
+      return NULL;
+    ssize_t got = read(STDIN_FILENO, p->input + p->input_size, p->input_capacity - p->input_size - 1);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      p->input_done = true;
+    else
+      p->input_size += got;
+  }
+}
+
+// `word` with every "{}" replaced by `input`, malloc'd.
+static char *substitute(const char *word, const char *input)
+{
+  size_t input_length = strlen(input);
+  size_t length = 0;
+  for (const char *s = word; *s;)
+  {
+    if (s[0] == '{' && s[1] == '}')
+    {
+      length += input_length;
+      s += 2;
+    }
+    else
+    {
+      length++;
+      s++;
+    }
+  }
+
+  char *result = malloc(length + 1);
+  if (result == NULL)
+    return NULL;
+  char *o = result;
+  for (const char *s = word; *s;)
+  {
+    if (s[0] == '{' && s[1] == '}')
+    {
+      memcpy(o, input, input_length);
+      o += input_length;
+      s += 2;
+    }
+    else
+    {
+      *o++ = *s++;
+    }
+  }
+  *o = '\0';
+  return result;
+}
+
+// Words the template leaves unchanged are shared with it, not copied.
+static void free_argv(const Parallel *p, char **argv)
+{
+  for (int i = 0; argv[i] != NULL; i++)
+  {
+    if (i >= p->template_count || argv[i] != p->template[i])
+      free(argv[i]);
+  }
+  free(argv);
+}
+
+static char **build_argv(const Parallel *p, const char *input)
+{
+  int count = p->template_count + (p->has_placeholder ? 0 : 1);
+  char **argv = calloc(count + 1, sizeof(char *));
+  if (argv == NULL)
+    return NULL;
+
+  bool ok = true;
+  for (int i = 0; i < p->template_count && ok; i++)
+  {
+    if (strstr(p->template[i], "{}") != NULL)
+      argv[i] = substitute(p->template[i], input);
+    else
+      argv[i] = p->template[i];
+    ok = argv[i] != NULL;
+  }
+  if (ok && !p->has_placeholder)
+  {
+    argv[count - 1] = strdup(input);
+    ok = argv[count - 1] != NULL;
+  }
+  if (!ok)
+  {
+    free_argv(p, argv);
+    return NULL;
+  }
+  return argv;
+}
+
+// Write a finished job's output to fd 1 in one go.
+static void write_output(int fd)
+{
+  if (fd == -1)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      write_all(STDOUT_FILENO, data, st.st_size);
+      munmap(data, st.st_size);
+    }
+    else
+    {
+      perror("mmap");
+    }
+  }
+  close(fd);
+}
+
+// Hand over a job that has exited (or never started). Without -k its
+// output goes out at once; with -k it waits for every earlier job.
+static void finish_task(Parallel *p, Task task)
+{
+  if (task.status != 0 && p->failures < MAX_FAILURES)
+    p->failures++;
+
+  if (!p->keep_order)
+  {
+    write_output(task.output);
+    return;
+  }
+
+  if (p->finished_count == p->finished_capacity)
+  {
+    int capacity = p->finished_capacity ? p->finished_capacity * 2 : 16;
+    Task *tmp = realloc(p->finished, capacity * sizeof(Task));
+    if (tmp == NULL)
+    {
+      perror("Memory allocation failed");
+      write_output(task.output); // Out of order, but not lost
+      return;
+    }
+    p->finished = tmp;
+    p->finished_capacity = capacity;
+  }
+  p->finished[p->finished_count++] = task;
+
+  bool progress = true;
+  while (progress)
+  {
+    progress = false;
+    for (int i = 0; i < p->finished_count; i++)
+    {
+      if (p->finished[i].seq != p->next_output)
+        continue;
+      write_output(p->finished[i].output);
+      p->finished[i] = p->finished[--p->finished_count];
+      p->next_output++;
+      progress = true;
+      break;
+    }
+  }
+}
+
+// Start the template for `input` in a free slot, through the same spawn
+// path as any other external command. A job that cannot be started
+// counts as failed and leaves the slot free.
+static void start_task(Parallel *p, const char *input)
+{
+  Task task = {-1, -1, -1, p->started++, 1};
+  char **argv = build_argv(p, input);
+  task.output = memfd_create("parallel", MFD_CLOEXEC);
+  if (argv == NULL || task.output == -1)
+  {
+    perror(argv == NULL ? "Memory allocation failed" : "memfd_create");
+  }
+  else
+  {
+    const char *exec_path = cmdhash_lookup(argv[0]);
+    Redirection no_redir = {NULL, 0, -1};
+    if (exec_path != NULL)
+      task.pid = spawn_program(exec_path, argv, vars_environ(), p->in_fd, task.output, &no_redir, -1);
+    if (task.pid == -1)
+    {
+      if (exec_path == NULL || errno == ENOENT)
+      {
+        cmdhash_forget(argv[0]);
+        not_found(argv[0]);
+        task.status = 127;
+      }
+      else
+      {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        task.status = 126;
+      }
+    }
+  }
+  if (argv != NULL)
+    free_argv(p, argv);
+
+  if (task.pid == -1)
+  {
+    if (task.output != -1)
+      close(task.output);
+    task.output = -1;
+    finish_task(p, task);
+    return;
+  }
+
+  task.pidfd = events_watch_child(task.pid);
+  p->running[p->running_count++] = task;
+}
+
+static void reap_task(Parallel *p, int index, int status)
+{
+  Task task = p->running[index];
+  p->running[index] = p->running[--p->running_count];
+  if (task.pidfd != -1)
+    events_unwatch_child(task.pidfd);
+  task.status = decode_status(status);
+  finish_task(p, task);
+}
+
+// Jobs without a pidfd are only noticed by polling after SIGCHLD.
+static bool reap_unwatched(Parallel *p)
+{
+  bool reaped = false;
+  int status;
+  for (int i = 0; i < p->running_count; i++)
+  {
+    if (p->running[i].pidfd == -1 && wait_child(p->running[i].pid, &status, WNOHANG) > 0)
+    {
+      reap_task(p, i--, status);
+      reaped = true;
+    }
+  }
+  return reaped;
+}
+
+// Sleep in the event loop until at least one running job has exited.
+static void wait_for_task(Parallel *p)
+{
+  events_begin(job_control);
+  int before = p->running_count;
+  while (p->running_count == before && !reap_unwatched(p))
+  {
+    Event event = events_next(-1);
+    int status;
+    if (event.type == EVENT_CHILD)
+    {
+      for (int i = 0; i < p->running_count; i++)
+      {
+        if (p->running[i].pidfd == event.fd)
+        {
+          if (wait_child(p->running[i].pid, &status, 0) > 0)
+            reap_task(p, i, status);
+          break;
+        }
+      }
+    }
+    else if (event.type == EVENT_SIGCHLD)
+    {
+      jobs_note_sigchld(); // May be for a background job too
+    }
+    else if (event.type == EVENT_INTERRUPT)
+    {
+      // The jobs share the shell's process group, so they got the ^C
+      // as well; start no more and collect what is left
+      if (!p->interrupted)
+        fprintf(stderr, "\n");
+      p->stop = true;
+      p->interrupted = true;
+    }
+    else
+    {
+      // No event loop: block on the oldest job
+      if (wait_child(p->running[0].pid, &status, 0) > 0)
+        reap_task(p, 0, status);
+    }
+  }
+  events_end();
+}
+
+static int usage(void)
+{
+  fprintf(stderr, "parallel: usage: parallel [-j N] [-k] COMMAND [ARG]... [::: INPUT...]\n");
+  return 255;
+}
+
+// Returns the number of jobs that failed (at most MAX_FAILURES), or
+// 128+SIGINT if it was interrupted.
+int execute_parallel(char **args, int count)
+{
+  Parallel p = {0};
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  p.max_jobs = cpus > 0 ? (int)cpus : 1;
+
+  int i = 1;
+  for (; i < count && args[i][0] == '-'; i++)
+  {
+    if (strcmp(args[i], "--") == 0)
+    {
+      i++;
+      break;
+    }
+    if (strcmp(args[i], "-k") == 0)
+    {
+      p.keep_order = true;
+    }
+    else if (strncmp(args[i], "-j", 2) == 0)
+    {
+      const char *value = args[i][2] ? args[i] + 2 : (i + 1 < count ? args[++i] : "");
+      char *end;
+      long jobs = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || jobs < 1 || jobs > INT_MAX)
+        return usage();
+      p.max_jobs = (int)jobs;
+    }
+    else
+    {
+      return usage();
+    }
+  }
+
+  p.template = args + i;
+  while (i < count && strcmp(args[i], ":::") != 0)
+    i++;
+  p.template_count = (int)(args + i - p.template);
+  if (i < count)
+  {
+    p.list = args + i + 1;
+    p.list_count = count - i - 1;
+  }
+  if (p.template_count == 0)
+    return usage();
+  for (int j = 0; j < p.template_count; j++)
+  {
+    if (strstr(p.template[j], "{}") != NULL)
+      p.has_placeholder = true;
+  }
+
+  // Input read from stdin is not also the jobs' to read. When stdin is
+  // the script itself, the inputs are the script lines after this one.
+  p.in_fd = -1;
+  if (p.list == NULL)
+  {
+    p.in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    size_t unread_size;
+    const char *unread = script_take_stdin(&unread_size);
+    if (unread != NULL && reserve_input(&p, unread_size))
+    {
+      memcpy(p.input, unread, unread_size);
+      p.input_size = unread_size;
+    }
+  }
+
+  p.running = malloc(p.max_jobs * sizeof(Task));
+  if (p.running == NULL)
+  {
+    perror("Memory allocation failed");
+    if (p.in_fd != -1)
+      close(p.in_fd);
+    return 1;
+  }
+
+  while (true)
+  {
+    while (!p.stop && p.running_count < p.max_jobs)
+    {
+      const char *input = next_input(&p);
+      if (input == NULL || jobs_take_interrupt())
+      {
+        p.stop = true;
+        p.interrupted = input != NULL;
+        break;
+      }
+      start_task(&p, input);
+    }
+    if (p.running_count == 0)
+      break;
+    wait_for_task(&p);
+  }
+
+  // Only left behind if memory ran out in finish_task()
+  for (int j = 0; j < p.finished_count; j++)
+    write_output(p.finished[j].output);
+
+  free(p.finished);
+  free(p.running);
+  free(p.input);
+  if (p.in_fd != -1)
+    close(p.in_fd);
+  return p.interrupted ? 128 + SIGINT : p.failures;
+}
@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// parallel [-j N] [-k] COMMAND [ARG]... [::: INPUT...]: run COMMAND once
+// per input, at most N at a time. Inputs are the words after ":::", or
+// else the lines of stdin. Each "{}" in the template is replaced by the
+// input; without one the input is appended as the last argument. A job's
+// stdout is collected in a memfd and written out in one piece when it
+// finishes, so output from different jobs never interleaves; -k writes it
+// in input order instead of completion order.
+
+int execute_parallel(char **args, int count);
+
+#endif
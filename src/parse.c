@@ -0,0 +1,736 @@
+#include "shell.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_ARGS 16
+
+bool parse_quiet = false;
+bool parse_complained = false;
+
+// Report a syntax error or warning about the input
+void parse_complain(const char *format, ...)
+{
+  parse_complained = true;
+  if (parse_quiet)
+    return;
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+static bool is_blank(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+// A descriptor number in front of a redirection, like the 2 in `2>>`.
+// Here-documents always go to stdin.
+static bool has_fd_prefix(const char *p)
+{
+  return isdigit((unsigned char)p[0]) && (p[1] == '>' || (p[1] == '<' && p[2] != '<'));
+}
+
+// Copy an unquoted operator at `*p` into `out`. Only called at the start
+// of a token, which is where a fd number may appear.
+static TokenKind lex_operator(const char **p, char **out)
+{
+  const char *s = *p;
+  if (s[0] == '|' || s[0] == ';' || (s[0] == '&' && s[1] == '&'))
+  {
+    // |, ||, && or ;
+    *(*out)++ = *(*p)++;
+    if (s[0] != ';' && s[1] == s[0])
+    {
+      *(*out)++ = *(*p)++;
+      return s[0] == '|' ? TOKEN_OR : TOKEN_AND;
+    }
+    return s[0] == '|' ? TOKEN_PIPE : TOKEN_SEMI;
+  }
+  if (s[0] == '&' && s[1] == '>')
+  {
+    // &> or &>>: stdout and stderr
+    *(*out)++ = *(*p)++;
+    *(*out)++ = *(*p)++;
+    if (**p == '>')
+      *(*out)++ = *(*p)++;
+    return TOKEN_REDIRECT;
+  }
+  if (*s == '&')
+  {
+    *(*out)++ = *(*p)++;
+    return TOKEN_BACKGROUND;
+  }
+  if (s[0] == '<' && s[1] == '<')
+  {
+    // <<, <<- or <<<
+    *(*out)++ = *(*p)++;
+    *(*out)++ = *(*p)++;
+    if (**p == '-' || **p == '<')
+      *(*out)++ = *(*p)++;
+    return TOKEN_REDIRECT;
+  }
+
+  if (has_fd_prefix(s))
+    *(*out)++ = *(*p)++;
+  if (**p == '>' || **p == '<')
+  {
+    // >, >>, >&, < or <&
+    char c = *(*out)++ = *(*p)++;
+    if ((c == '>' && **p == '>') || **p == '&')
+      *(*out)++ = *(*p)++;
+    return TOKEN_REDIRECT;
+  }
+
+  return TOKEN_WORD;
+}
+
+static bool starts_operator(const char *p)
+{
+  return *p == '|' || *p == '&' || *p == ';' || *p == '>' || *p == '<' || has_fd_prefix(p);
+}
+
+// Double the argument arrays. The old ones stay in the arena until it is
+// reset, which costs at most as much again as the final arrays.
+static bool grow_args(Command *cmd, int *capacity, Arena *arena)
+{
+  int new_capacity = *capacity * 2;
+  char **args = arena_alloc(arena, (new_capacity + 1) * sizeof(char *));
+  TokenKind *kinds = arena_alloc(arena, new_capacity * sizeof(TokenKind));
+  if (args == NULL || kinds == NULL)
+    return false;
+  memcpy(args, cmd->args, cmd->arg_count * sizeof(char *));
+  memcpy(kinds, cmd->kinds, cmd->arg_count * sizeof(TokenKind));
+  cmd->args = args;
+  cmd->kinds = kinds;
+  *capacity = new_capacity;
+  return true;
+}
+
+// Unquoted bytes that end a word
+static bool ends_word(char c)
+{
+  switch (c)
+  {
+  case '\0':
+  case ' ':
+  case '\t':
+  case '\n':
+  case '|':
+  case '&':
+  case ';':
+  case '>':
+  case '<':
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Copy the byte at `*s`, behind an EXPAND_END if it is one of the marks
+static void copy_byte(const char **s, char **o)
+{
+  if (**s == EXPAND_UNQUOTED || **s == EXPAND_QUOTED || **s == EXPAND_END)
+    *(*o)++ = EXPAND_END;
+  *(*o)++ = *(*s)++;
+}
+
+// Length of the parameter name at `p`: a variable name, or a digit, ? or $
+// on its own. 0 if there is none.
+static size_t parameter_length(const char *p)
+{
+  if (isdigit((unsigned char)*p) || *p == '?' || *p == '$')
+    return 1;
+  if (!isalpha((unsigned char)*p) && *p != '_')
+    return 0;
+  size_t length = 1;
+  while (isalnum((unsigned char)p[length]) || p[length] == '_')
+    length++;
+  return length;
+}
+
+// Mark $NAME or ${NAME} at `*s` as `mark` NAME EXPAND_END. Returns false,
+// copying nothing, when the $ starts neither and is just a $.
+static bool lex_parameter(const char **s, char **o, char mark)
+{
+  const char *name = *s + 1;
+  bool braced = *name == '{';
+  name += braced;
+  size_t length = parameter_length(name);
+  if (length == 0 || (braced && name[length] != '}'))
+    return false;
+
+  *(*o)++ = mark;
+  memcpy(*o, name, length);
+  *o += length;
+  *(*o)++ = EXPAND_END;
+  *s = name + length + braced;
+  return true;
+}
+
+// Copy one word at `*p` into `out`, removing quotes and backslashes and
+// marking $ expansions as it goes. Stops at an unquoted blank, newline or
+// operator.
+static void lex_word(const char **p, char **out)
+{
+  const char *s = *p;
+  char *o = *out;
+
+  while (!ends_word(*s))
+  {
+    if (*s == '\'')
+    {
+      // Single quotes: everything literal up to the closing quote
+      s++;
+      while (*s && *s != '\'' && *s != '\n')
+        copy_byte(&s, &o);
+      if (*s == '\'')
+        s++;
+    }
+    else if (*s == '"')
+    {
+      // Double quotes: only \", \\ and \$ are escapes
+      s++;
+      while (*s && *s != '"' && *s != '\n')
+      {
+        if (*s == '\\' && (s[1] == '\\' || s[1] == '"' || s[1] == '$'))
+          s++;
+        else if (*s == '$' && lex_parameter(&s, &o, EXPAND_QUOTED))
+          continue;
+        copy_byte(&s, &o);
+      }
+      if (*s == '"')
+        s++;
+    }
+    else if (*s == '\\')
+    {
+      s++;
+      if (*s && *s != '\n')
+        copy_byte(&s, &o);
+    }
+    else if (*s != '$' || !lex_parameter(&s, &o, EXPAND_UNQUOTED))
+    {
+      copy_byte(&s, &o);
+    }
+  }
+
+  *p = s;
+  *out = o;
+}
+
+static const char *const reserved_words[] = {"if", "then", "elif", "else", "fi", "for",
+                                             "in", "do", "done", "while", "until", NULL};
+
+static bool is_reserved(const char *word, size_t length)
+{
+  if (length < 2 || length > 5 || strchr("itefdwu", word[0]) == NULL)
+    return false;
+  for (int i = 0; reserved_words[i] != NULL; i++)
+  {
+    if (strcmp(word, reserved_words[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+// A command with no tokens yet and room for `*capacity` of them
+static Command *new_command(int *capacity, Arena *arena)
+{
+  Command *cmd = arena_alloc(arena, sizeof(Command));
+  *capacity = INITIAL_ARGS;
+  char **args = arena_alloc(arena, (*capacity + 1) * sizeof(char *));
+  TokenKind *kinds = arena_alloc(arena, *capacity * sizeof(TokenKind));
+  if (cmd == NULL || args == NULL || kinds == NULL)
+  {
+    perror("Memory allocation failed");
+    return NULL;
+  }
+  cmd->name = NULL;
+  cmd->args = args;
+  cmd->arg_count = 0;
+  cmd->kinds = kinds;
+  cmd->text = NULL;
+  cmd->background = false;
+  return cmd;
+}
+
+static bool add_token(Command *cmd, int *capacity, char *token, TokenKind kind, Arena *arena)
+{
+  if (cmd->arg_count == *capacity && !grow_args(cmd, capacity, arena))
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+  cmd->args[cmd->arg_count] = token;
+  cmd->kinds[cmd->arg_count] = kind;
+  cmd->arg_count++;
+  return true;
+}
+
+// Split the first line of `input` into tokens in a single pass and add
+// them to `cmd`. Unescaped bytes go straight into one buffer shared by
+// all arguments, and each token records whether it is a word or an
+// operator, so a quoted "|" stays a plain argument. `*rest` is set to the
+// text after the line.
+static bool lex_line(const char *input, Command *cmd, int *capacity, Arena *arena, const char **rest)
+{
+  const char *newline = strchr(input, '\n');
+  size_t len = newline != NULL ? (size_t)(newline - input) : strlen(input);
+
+  // Each token costs at most twice its input bytes plus a terminator, a
+  // literal mark byte being copied as two
+  char *storage = arena_alloc(arena, 2 * len + 1);
+  if (storage == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  const char *p = input;
+  char *out = storage;
+
+  while (true)
+  {
+    while (is_blank(*p))
+      p++;
+    if (!*p || *p == '\n' || *p == '#') // A comment runs to the end of the line
+      break;
+
+    char *token = out;
+    const char *start = p;
+    TokenKind kind = TOKEN_WORD;
+    if (starts_operator(p))
+      kind = lex_operator(&p, &out);
+    if (kind == TOKEN_WORD)
+      lex_word(&p, &out);
+    *out++ = '\0';
+    // Quotes and backslashes are never copied, so a word that had any is
+    // shorter than its input and stays a plain word, like "if" or \done
+    if (kind == TOKEN_WORD && out - 1 - token == p - start && is_reserved(token, p - start))
+      kind = TOKEN_RESERVED;
+
+    if (!add_token(cmd, capacity, token, kind, arena))
+      return false;
+  }
+
+  *rest = newline != NULL ? newline + 1 : input + len;
+  return true;
+}
+
+// `word` with the marks the lexer left for $ expansions turned back into
+// $NAME, for where a word is used as typed: as a here-document delimiter,
+// or to show a command in the job table.
+const char *unexpanded_word(const char *word, Arena *arena)
+{
+  if (strpbrk(word, EXPAND_MARKS) == NULL)
+    return word;
+  char *text = arena_alloc(arena, strlen(word) + 1); // Never longer
+  if (text == NULL)
+    return word;
+
+  char *out = text;
+  for (const char *p = word; *p; p++)
+  {
+    if (*p == EXPAND_UNQUOTED || *p == EXPAND_QUOTED)
+    {
+      *out++ = '$';
+      while (*++p != EXPAND_END)
+        *out++ = *p;
+    }
+    else if (*p == EXPAND_END)
+    {
+      *out++ = *++p;
+    }
+    else
+    {
+      *out++ = *p;
+    }
+  }
+  *out = '\0';
+  return text;
+}
+
+static bool is_heredoc(const char *op)
+{
+  return strcmp(op, "<<") == 0 || strcmp(op, "<<-") == 0;
+}
+
+// Walk a here-document body from `p`: every line up to one that is exactly
+// `delimiter`, with leading tabs dropped from each line for <<-. The lines
+// are appended to `*out` unless it is NULL. Returns the text after the
+// delimiter line, or NULL if `end` comes first.
+static const char *scan_body(const char *p, const char *end, const char *delimiter, bool strip_tabs, char **out)
+{
+  size_t delimiter_length = strlen(delimiter);
+  while (p < end)
+  {
+    while (strip_tabs && p < end && *p == '\t')
+      p++;
+    const char *newline = memchr(p, '\n', end - p);
+    size_t length = newline != NULL ? (size_t)(newline - p) : (size_t)(end - p);
+    if (length == delimiter_length && memcmp(p, delimiter, length) == 0)
+      return newline != NULL ? newline + 1 : end;
+
+    if (out != NULL)
+    {
+      memcpy(*out, p, length);
+      *out += length;
+      *(*out)++ = '\n';
+    }
+    p += length + (newline != NULL);
+  }
+  return NULL;
+}
+
+// A descriptor number, or "-" to close
+static bool is_fd_word(const char *word)
+{
+  if (strcmp(word, "-") == 0)
+    return true;
+  if (*word == '\0')
+    return false;
+  while (isdigit((unsigned char)*word))
+    word++;
+  return *word == '\0';
+}
+
+// Operator at args[i] must be followed by a word: the file, descriptor,
+// delimiter or here-string. A reserved word there is just a word.
+static bool check_operand(Command *cmd, int i)
+{
+  if (i + 1 < cmd->arg_count && cmd->kinds[i + 1] == TOKEN_RESERVED)
+    cmd->kinds[i + 1] = TOKEN_WORD;
+  if (i + 1 < cmd->arg_count && cmd->kinds[i + 1] == TOKEN_WORD)
+    return true;
+  parse_complain("syntax error near unexpected token `%s'\n", i + 1 < cmd->arg_count ? cmd->args[i + 1] : "newline");
+  return false;
+}
+
+// Check the word after every redirection operator from args[first] on.
+// The delimiter after each << or <<- is replaced with the here-document
+// read from the lines at `*rest`, in order, and `*rest` moves past them;
+// the word after <<< is replaced with itself plus a newline. Returns
+// false after a syntax error.
+static bool read_operands(Command *cmd, int first, const char **rest, const char *end, Arena *arena)
+{
+  for (int i = first; i < cmd->arg_count; i++)
+  {
+    if (cmd->kinds[i] != TOKEN_REDIRECT)
+      continue;
+    if (!check_operand(cmd, i))
+      return false;
+
+    const char *op = cmd->args[i++];
+    const char *word = cmd->args[i];
+    // [n]>& and [n]<& take a descriptor; only a bare >&word means &>word
+    if (op[strlen(op) - 1] == '&' && strcmp(op, ">&") != 0 && !is_fd_word(word))
+    {
+      parse_complain("%s: ambiguous redirect\n", word);
+      return false;
+    }
+    if (!is_heredoc(op) && strcmp(op, "<<<") != 0)
+      continue;
+    size_t size = is_heredoc(op) ? (size_t)(end - *rest) + 1 : strlen(word) + 2;
+    char *body = arena_alloc(arena, size);
+    if (body == NULL)
+    {
+      perror("Memory allocation failed");
+      return false;
+    }
+
+    if (!is_heredoc(op))
+    {
+      sprintf(body, "%s\n", word);
+    }
+    else
+    {
+      char *out = body;
+      word = unexpanded_word(word, arena);
+      const char *after = scan_body(*rest, end, word, op[2] == '-', &out);
+      if (after == NULL)
+      {
+        parse_complain("warning: here-document delimited by end-of-file (wanted `%s')\n", word);
+        after = end;
+      }
+      *out = '\0';
+      *rest = after;
+    }
+    cmd->args[i] = body;
+  }
+  return true;
+}
+
+static bool is_separator(TokenKind kind)
+{
+  return kind == TOKEN_PIPE || kind == TOKEN_BACKGROUND || kind == TOKEN_AND || kind == TOKEN_OR ||
+         kind == TOKEN_SEMI || kind == TOKEN_NEWLINE;
+}
+
+// Move the redirections of every simple command after its words, each
+// group in the order written, so that `echo a >f b` is `echo a b >f` and
+// the arguments always end at the first operator. The separators and
+// reserved words that start a command stay where they are.
+static bool gather_redirections(Command *cmd, Arena *arena)
+{
+  int operators = 0;
+  for (int i = 0; i < cmd->arg_count; i++)
+    operators += cmd->kinds[i] == TOKEN_REDIRECT;
+  if (operators == 0)
+    return true;
+
+  char **held = arena_alloc(arena, 2 * operators * sizeof(char *));
+  if (held == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  int i = 0;
+  while (i < cmd->arg_count)
+  {
+    int out = i;
+    int count = 0;
+    for (; i < cmd->arg_count && !is_separator(cmd->kinds[i]); i++)
+    {
+      if (cmd->kinds[i] == TOKEN_REDIRECT)
+      {
+        // read_operands() has made sure a word follows
+        held[count++] = cmd->args[i++];
+        held[count++] = cmd->args[i];
+        continue;
+      }
+      cmd->args[out] = cmd->args[i];
+      cmd->kinds[out++] = cmd->kinds[i];
+    }
+    for (int j = 0; j < count; j++)
+    {
+      cmd->args[out] = held[j];
+      cmd->kinds[out++] = j % 2 == 0 ? TOKEN_REDIRECT : TOKEN_WORD;
+    }
+    i++; // The separator
+  }
+  return true;
+}
+
+// Parse a command into one stream of tokens. Each line is followed by
+// the bodies of the here-documents it opens, if any, and the lines left
+// after those (the rest of an if, for or while) come next with a
+// TOKEN_NEWLINE in between. Structure is left to parse_tree(). Everything
+// is allocated from `arena` and lives until it is reset.
+Command *parse_command(const char *input, Arena *arena)
+{
+  int capacity;
+  Command *cmd = new_command(&capacity, arena);
+  if (cmd == NULL)
+    return NULL;
+
+  const char *end = input + strlen(input);
+  const char *line = input;
+  const char *first_rest = NULL;
+  while (true)
+  {
+    int first = cmd->arg_count;
+    const char *rest;
+    if (!lex_line(line, cmd, &capacity, arena, &rest))
+      return NULL;
+    if (first_rest == NULL)
+      first_rest = rest;
+    if (!read_operands(cmd, first, &rest, end, arena))
+      return NULL;
+    if (rest >= end)
+      break;
+    if (!add_token(cmd, &capacity, "\n", TOKEN_NEWLINE, arena))
+      return NULL;
+    line = rest;
+  }
+
+  if (!gather_redirections(cmd, arena))
+    return NULL;
+
+  // The job table shows the first line only
+  cmd->text = input;
+  if (first_rest > input && first_rest[-1] == '\n')
+  {
+    size_t length = first_rest - 1 - input;
+    char *text = arena_alloc(arena, length + 1);
+    if (text != NULL)
+    {
+      memcpy(text, input, length);
+      text[length] = '\0';
+      cmd->text = text;
+    }
+  }
+
+  cmd->args[cmd->arg_count] = NULL;
+  cmd->name = cmd->args[0];
+  return cmd;
+}
+
+// How many constructs the line in `cmd` opens (if, for, while, until)
+// less how many it closes (fi, done). Reserved words count only where a
+// command could start, so `echo done` and `for x in if` close and open
+// nothing.
+static int nesting_change(const Command *cmd)
+{
+  int change = 0;
+  bool command_start = true;
+  bool for_header = false; // Between "for" and the end of its word list
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    const char *word = cmd->args[i];
+    if (cmd->kinds[i] == TOKEN_RESERVED && command_start && !for_header)
+    {
+      if (strcmp(word, "if") == 0 || strcmp(word, "for") == 0 || strcmp(word, "while") == 0 ||
+          strcmp(word, "until") == 0)
+        change++;
+      else if (strcmp(word, "fi") == 0 || strcmp(word, "done") == 0)
+        change--;
+      for_header = strcmp(word, "for") == 0;
+      continue;
+    }
+    command_start = is_separator(cmd->kinds[i]);
+    if (cmd->kinds[i] == TOKEN_SEMI || cmd->kinds[i] == TOKEN_NEWLINE)
+      for_header = false;
+  }
+  return change;
+}
+
+// Length of the command at the start of `text`: its lines, each followed
+// by the bodies of the here-documents it opens, up to the end of the line
+// that closes every if, for, while and until and does not end in |, &&
+// or ||. Returns 0 if `text` ends first.
+size_t command_extent(const char *text, size_t size, Arena *arena)
+{
+  const char *end = text + size;
+  const char *p = text;
+  int depth = 0;
+  while (true)
+  {
+    const char *newline = memchr(p, '\n', end - p);
+    size_t line_length = newline != NULL ? (size_t)(newline - p) : (size_t)(end - p);
+    const char *next = newline != NULL ? newline + 1 : end;
+    char *line = arena_alloc(arena, line_length + 1);
+    int capacity;
+    Command *cmd = line != NULL ? new_command(&capacity, arena) : NULL;
+    const char *rest;
+    if (cmd == NULL)
+      return (size_t)(p - text) + line_length;
+    memcpy(line, p, line_length);
+    line[line_length] = '\0';
+    if (!lex_line(line, cmd, &capacity, arena, &rest))
+      return (size_t)(p - text) + line_length;
+
+    for (int i = 0; i < cmd->arg_count; i++)
+    {
+      if (cmd->kinds[i] != TOKEN_REDIRECT || !is_heredoc(cmd->args[i]) || i + 1 == cmd->arg_count ||
+          (cmd->kinds[i + 1] != TOKEN_WORD && cmd->kinds[i + 1] != TOKEN_RESERVED))
+        continue;
+      next = scan_body(next, end, unexpanded_word(cmd->args[i + 1], arena), cmd->args[i][2] == '-', NULL);
+      if (next == NULL)
+        return 0;
+    }
+
+    depth += nesting_change(cmd);
+    TokenKind last = cmd->arg_count > 0 ? cmd->kinds[cmd->arg_count - 1] : TOKEN_NEWLINE;
+    if (depth <= 0 && last != TOKEN_PIPE && last != TOKEN_AND && last != TOKEN_OR)
+      return next > text && next[-1] == '\n' ? (size_t)(next - text) - 1 : (size_t)(next - text);
+    if (next >= end)
+      return 0;
+    p = next;
+  }
+}
+
+bool has_pipeline(const Command *cmd)
+{
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    if (cmd->kinds[i] == TOKEN_PIPE)
+      return true;
+  }
+  return false;
+}
+
+void print_debug_info(const Command *cmd)
+{
+  printf("CMD: %s\n", cmd->name);
+  printf("ARGS: |");
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    printf(" %s |", cmd->args[i]);
+  }
+  printf("\n");
+}
+
+// Turn the redirection operators of `cmd` into steps, in order. The
+// words after them were checked by parse_command(). Returns false if
+// there is no memory for the steps.
+bool parse_redirection(const Command *cmd, Redirection *redir, Arena *arena)
+{
+  redir->steps = NULL;
+  redir->count = 0;
+  redir->operator_index = -1;
+
+  int operators = 0;
+  for (int i = 0; i < cmd->arg_count; i++)
+  {
+    if (cmd->kinds[i] == TOKEN_REDIRECT && operators++ == 0)
+      redir->operator_index = i;
+  }
+  if (operators == 0)
+    return true;
+
+  // &> takes two steps
+  redir->steps = arena_alloc(arena, 2 * operators * sizeof(RedirectionStep));
+  if (redir->steps == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  for (int i = 0; i < cmd->arg_count - 1; i++)
+  {
+    if (cmd->kinds[i] != TOKEN_REDIRECT)
+      continue;
+    const char *op = cmd->args[i];
+    const char *word = cmd->args[++i];
+    RedirectionStep *step = &redir->steps[redir->count++];
+
+    int fd = -1;
+    if (isdigit((unsigned char)op[0]))
+      fd = *op++ - '0';
+
+    bool both = op[0] == '&' || (strcmp(op, ">&") == 0 && fd == -1 && strcmp(word, "-") != 0 &&
+                                 !isdigit((unsigned char)word[0]));
+    if (both)
+    {
+      // &>word, &>>word and >&word: stdout to the file, then 2>&1
+      *step = (RedirectionStep){strcmp(op, "&>>") == 0 ? REDIRECT_APPEND : REDIRECT_OUTPUT, 1, word, -1};
+      redir->steps[redir->count++] = (RedirectionStep){REDIRECT_DUP, 2, NULL, 1};
+    }
+    else if (op[0] == '<' && op[1] == '<')
+    {
+      *step = (RedirectionStep){REDIRECT_TEXT, 0, word, -1};
+    }
+    else if (op[1] == '&')
+    {
+      long source = strcmp(word, "-") == 0 ? -1 : strtol(word, NULL, 10);
+      if (source > INT_MAX)
+        source = INT_MAX; // Never open, so reported as a bad descriptor
+      *step = (RedirectionStep){REDIRECT_DUP, fd != -1 ? fd : op[0] == '<' ? 0 : 1, NULL, source};
+    }
+    else if (op[0] == '<')
+    {
+      *step = (RedirectionStep){REDIRECT_INPUT, fd != -1 ? fd : 0, word, -1};
+    }
+    else
+    {
+      *step = (RedirectionStep){op[1] == '>' ? REDIRECT_APPEND : REDIRECT_OUTPUT, fd != -1 ? fd : 1, word, -1};
+    }
+  }
+  return true;
+}
@@ -0,0 +1,384 @@
+#include "pathscan.h"
+#include "cmdhash.h"
+#include "hash.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INITIAL_EXEC_CAPACITY 256
+#define MAX_SCAN_THREADS 8
+
+typedef struct
+{
+  const char *path;
+  char **names;
+  size_t count;
+  size_t capacity;
+  size_t entries;
+} DirScan;
+
+typedef struct
+{
+  DirScan *dirs;
+  int dir_count;
+  atomic_int next_dir;
+} ScanJob;
+
+typedef struct
+{
+  char **names; // NULL-terminated
+  const char **dirs; // PATH directory each name resolves to
+  size_t count;
+  char *path_copy; // Owns the strings `dirs` points into
+} ScanResult;
+
+static PathScanStats last_stats;
+
+static pthread_t scan_thread;
+static bool scan_started = false;
+static atomic_bool scan_done = false;
+static ScanResult background_result;
+
+// A PATH asked for while a scan was running; that scan's result is stale
+static bool rescan_pending = false;
+static char *pending_path = NULL;
+
+static bool dir_add_name(DirScan *scan, const char *name)
+{
+  if (scan->count == scan->capacity)
+  {
+    size_t new_capacity = scan->capacity ? scan->capacity * 2 : INITIAL_EXEC_CAPACITY;
+    char **tmp = realloc(scan->names, new_capacity * sizeof(char *));
+    if (!tmp)
+      return false;
+    scan->names = tmp;
+    scan->capacity = new_capacity;
+  }
+  char *copy = strdup(name);
+  if (!copy)
+    return false;
+  scan->names[scan->count++] = copy;
+  return true;
+}
+
+static void scan_directory(DirScan *scan)
+{
+  int dir_fd = open(scan->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1)
+    return;
+
+  DIR *dir = fdopendir(dir_fd);
+  if (!dir)
+  {
+    close(dir_fd);
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    // Skip . and .. and anything the directory entry already rules out
+    if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' ||
+                                    (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+      continue;
+    if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+      continue;
+    scan->entries++;
+
+    // Relative to the directory fd, so no full path has to be built
+    if (is_executable_at(dir_fd, entry->d_name))
+    {
+      if (!dir_add_name(scan, entry->d_name))
+        break;
+    }
+  }
+  closedir(dir);
+}
+
+static void *scan_worker(void *arg)
+{
+  ScanJob *job = arg;
+  int i;
+  while ((i = atomic_fetch_add(&job->next_dir, 1)) < job->dir_count)
+    scan_directory(&job->dirs[i]);
+  return NULL;
+}
+
+// Open-addressing set insert; returns false if `name` was already present.
+static bool set_insert(const char **set, size_t mask, const char *name)
+{
+  size_t slot = hash_string(name) & mask;
+  while (set[slot])
+  {
+    if (strcmp(set[slot], name) == 0)
+      return false;
+    slot = (slot + 1) & mask;
+  }
+  set[slot] = name;
+  return true;
+}
+
+static int scan_thread_count(int dir_count)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = cpus > 0 ? (int)cpus : 1;
+  if (threads > MAX_SCAN_THREADS)
+    threads = MAX_SCAN_THREADS;
+  if (threads > dir_count)
+    threads = dir_count;
+  return threads;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Scan the directories in `path_copy`, which the result takes ownership of.
+static void scan_path(char *path_copy, ScanResult *result)
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(result, 0, sizeof(*result));
+  memset(&last_stats, 0, sizeof(last_stats));
+
+  if (!path_copy)
+    return;
+
+  int dir_count = 1;
+  for (const char *p = path_copy; *p; p++)
+  {
+    if (*p == ':')
+      dir_count++;
+  }
+
+  DirScan *dirs = calloc(dir_count, sizeof(DirScan));
+  if (!dirs)
+  {
+    free(path_copy);
+    return;
+  }
+
+  dir_count = 0;
+  char *saveptr;
+  char *dir_path = strtok_r(path_copy, ":", &saveptr);
+  while (dir_path)
+  {
+    dirs[dir_count++].path = dir_path;
+    dir_path = strtok_r(NULL, ":", &saveptr);
+  }
+
+  // Scan every PATH directory concurrently; the calling thread works too
+  ScanJob job = {.dirs = dirs, .dir_count = dir_count};
+  atomic_init(&job.next_dir, 0);
+  int threads = scan_thread_count(dir_count);
+  pthread_t workers[MAX_SCAN_THREADS];
+  int started = 0;
+  for (int i = 1; i < threads; i++)
+  {
+    if (pthread_create(&workers[started], NULL, scan_worker, &job) == 0)
+      started++;
+  }
+  scan_worker(&job);
+  for (int i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+
+  // Merge in PATH order, deduplicating through a hash set
+  size_t total = 0;
+  for (int i = 0; i < dir_count; i++)
+  {
+    total += dirs[i].count;
+    last_stats.entries += dirs[i].entries;
+  }
+
+  size_t set_size = 16;
+  while (set_size < total * 2)
+    set_size *= 2;
+  const char **set = calloc(set_size, sizeof(char *));
+  char **executables = malloc((total + 1) * sizeof(char *));
+  const char **exec_dirs = malloc((total + 1) * sizeof(char *));
+  size_t exec_count = 0;
+
+  for (int i = 0; i < dir_count; i++)
+  {
+    for (size_t j = 0; j < dirs[i].count; j++)
+    {
+      char *name = dirs[i].names[j];
+      if (set && executables && exec_dirs && set_insert(set, set_size - 1, name))
+      {
+        exec_dirs[exec_count] = dirs[i].path;
+        executables[exec_count++] = name;
+      }
+      else
+      {
+        free(name);
+      }
+    }
+    free(dirs[i].names);
+  }
+  if (executables)
+    executables[exec_count] = NULL;
+
+  free(set);
+  free(dirs);
+
+  result->names = executables;
+  result->dirs = exec_dirs;
+  result->count = exec_count;
+  result->path_copy = path_copy;
+
+  last_stats.directories = dir_count;
+  last_stats.threads = started + 1;
+  last_stats.executables = exec_count;
+  last_stats.elapsed_ms = elapsed_ms(&start);
+}
+
+// Hand the scan over to the main thread: seed the command-location cache
+// (which is not thread safe) and keep only the name list.
+static char **adopt_result(ScanResult *result)
+{
+  if (result->names && result->dirs)
+  {
+    // First match in PATH order is also where the command resolves
+    for (size_t i = 0; i < result->count; i++)
+      cmdhash_seed(result->dirs[i], result->names[i]);
+  }
+  free(result->dirs);
+  free(result->path_copy);
+  return result->names;
+}
+
+static char *copy_path_env(void)
+{
+  const char *path = getenv("PATH");
+  return path ? strdup(path) : NULL;
+}
+
+char **get_executables_from_path(void)
+{
+  ScanResult result;
+  scan_path(copy_path_env(), &result);
+  return adopt_result(&result);
+}
+
+static void *background_scan(void *arg)
+{
+  // PATH was copied on the main thread, where it can change
+  scan_path(arg, &background_result);
+  atomic_store(&scan_done, true);
+  return NULL;
+}
+
+static void discard_result(ScanResult *result)
+{
+  free_executables(result->names);
+  free(result->dirs);
+  free(result->path_copy);
+}
+
+// Scan `path_copy`, which the scan takes ownership of, on its own thread,
+// or inline if there is no thread.
+static void launch_scan(char *path_copy)
+{
+  scan_started = true;
+  if (pthread_create(&scan_thread, NULL, background_scan, path_copy) != 0)
+  {
+    background_scan(path_copy);
+    scan_started = false;
+  }
+}
+
+// Build the executable index for the directories in `path` off the main
+// thread so the prompt is not held up by the scan. If a scan is already
+// running, `path` is kept and scanned once that one is done, and the
+// running scan's result is thrown away instead of being handed out.
+void start_executable_scan(const char *path)
+{
+  char *path_copy = path != NULL ? strdup(path) : NULL;
+  if (scan_started)
+  {
+    free(pending_path);
+    pending_path = path_copy;
+    rescan_pending = true;
+    return;
+  }
+  if (atomic_load(&scan_done))
+  {
+    // An inline scan nobody picked up
+    discard_result(&background_result);
+    atomic_store(&scan_done, false);
+  }
+  launch_scan(path_copy);
+}
+
+// The finished scan's index, or NULL if a newer PATH superseded it and a
+// scan of that has been started in its place.
+static char **finish_scan(void)
+{
+  if (scan_started)
+    pthread_join(scan_thread, NULL);
+  scan_started = false;
+  atomic_store(&scan_done, false);
+  if (rescan_pending)
+  {
+    discard_result(&background_result);
+    rescan_pending = false;
+    char *path_copy = pending_path;
+    pending_path = NULL;
+    launch_scan(path_copy);
+    return NULL;
+  }
+  return adopt_result(&background_result);
+}
+
+// Non-blocking: the index if the background scan has finished, else NULL.
+char **poll_executable_scan(void)
+{
+  if (!atomic_load(&scan_done))
+    return NULL;
+  return finish_scan();
+}
+
+// Block until the scan of the latest PATH is done and return its index.
+char **wait_executable_scan(void)
+{
+  while (scan_started || atomic_load(&scan_done))
+  {
+    bool superseded = rescan_pending;
+    char **executables = finish_scan();
+    if (!superseded)
+      return executables;
+  }
+  return NULL;
+}
+
+void free_executables(char **executables)
+{
+  if (!executables)
+    return;
+  for (char **p = executables; *p; p++)
+    free(*p);
+  free(executables);
+}
+
+const PathScanStats *pathscan_stats(void)
+{
+  return &last_stats;
+}
+
+void print_scan_stats(FILE *out)
+{
+  fprintf(out, "PATH scan: %zu executables (%zu entries) in %d directories, %d threads, %.3f ms\n",
+          last_stats.executables, last_stats.entries, last_stats.directories,
+          last_stats.threads, last_stats.elapsed_ms);
+}
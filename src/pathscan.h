@@ -0,0 +1,27 @@
+#ifndef PATHSCAN_H
+#define PATHSCAN_H
+
+#include <stdio.h>
+
+// Enumerates the executables reachable through PATH for tab completion.
+// Directories are scanned concurrently and merged in PATH order so the
+// first directory containing a name wins, like command lookup does.
+
+typedef struct
+{
+  int directories;
+  int threads;
+  size_t entries;
+  size_t executables;
+  double elapsed_ms;
+} PathScanStats;
+
+char **get_executables_from_path(void);
+void start_executable_scan(const char *path);
+char **poll_executable_scan(void);
+char **wait_executable_scan(void);
+void free_executables(char **executables);
+const PathScanStats *pathscan_stats(void);
+void print_scan_stats(FILE *out);
+
+#endif
@@ -0,0 +1,278 @@
+#include "pathwatch.h"
+#include "cmdhash.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct
+{
+  int wd;
+  char *dir;
+} WatchedDir;
+
+static int inotify_fd = -1;
+static WatchedDir *watched = NULL;
+static int watched_count = 0;
+
+static void free_watched(WatchedDir *dirs, int count)
+{
+  for (int i = 0; i < count; i++)
+    free(dirs[i].dir);
+  free(dirs);
+}
+
+static char **watched_dirs(void)
+{
+  char **dirs = malloc((watched_count + 1) * sizeof(char *));
+  if (!dirs)
+    return NULL;
+  for (int i = 0; i < watched_count; i++)
+    dirs[i] = watched[i].dir;
+  return dirs;
+}
+
+static const char *dir_for_wd(int wd)
+{
+  for (int i = 0; i < watched_count; i++)
+  {
+    if (watched[i].wd == wd)
+      return watched[i].dir;
+  }
+  return NULL;
+}
+
+// Re-resolve one name after something changed it in some PATH directory.
+static void refresh_name(const char *name, char **dirs, int count, CompletionIndex *index)
+{
+  cmdhash_forget(name);
+  char *path = search_path(name, dirs, count);
+  if (path)
+    completion_index_add(index, name, COMPLETE_EXECUTABLE);
+  else
+    completion_index_remove(index, name, COMPLETE_EXECUTABLE);
+  free(path);
+}
+
+static WatchedDir *build_watches(char **path_tokens, int path_count, int *count)
+{
+  WatchedDir *dirs = calloc(path_count ? path_count : 1, sizeof(WatchedDir));
+  if (!dirs)
+    return NULL;
+  for (int i = 0; i < path_count; i++)
+  {
+    dirs[i].dir = strdup(path_tokens[i]);
+    dirs[i].wd = -1;
+    if (!dirs[i].dir)
+    {
+      free_watched(dirs, i);
+      return NULL;
+    }
+  }
+  *count = path_count;
+  return dirs;
+}
+
+bool pathwatch_start(char **path_tokens, int path_count)
+{
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd == -1)
+    return false;
+
+  watched = build_watches(path_tokens, path_count, &watched_count);
+  if (!watched)
+  {
+    pathwatch_stop();
+    return false;
+  }
+  for (int i = 0; i < watched_count; i++)
+    watched[i].wd = inotify_add_watch(inotify_fd, watched[i].dir, WATCH_MASK);
+  return true;
+}
+
+// Whether any of `dirs` still uses the watch `wd`. The kernel hands out
+// one watch per directory, so PATH entries naming the same directory
+// twice, or through a symlink, share it.
+static bool wd_in_use(const WatchedDir *dirs, int count, int wd)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (dirs[i].wd == wd)
+      return true;
+  }
+  return false;
+}
+
+// Refresh every name found in `dir` against the current PATH.
+static void refresh_directory(const char *dir, char **dirs, int count, CompletionIndex *index)
+{
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL)
+  {
+    if (entry->d_type == DT_DIR)
+      continue;
+    refresh_name(entry->d_name, dirs, count, index);
+  }
+  closedir(d);
+}
+
+// Try again to watch the PATH directories that had no watch, because they
+// did not exist yet or went away, and take in the names of any that have
+// turned up since.
+static void watch_missing(char **dirs, CompletionIndex *index)
+{
+  for (int i = 0; i < watched_count; i++)
+  {
+    if (watched[i].wd != -1)
+      continue;
+    watched[i].wd = inotify_add_watch(inotify_fd, watched[i].dir, WATCH_MASK);
+    if (watched[i].wd != -1)
+      refresh_directory(watched[i].dir, dirs, watched_count, index);
+  }
+}
+
+// Apply every queued change to the caches without blocking. Returns false
+// when events were lost or a whole directory went away, in which case the
+// caller has to rebuild the executable index from scratch.
+bool pathwatch_process(CompletionIndex *index)
+{
+  if (inotify_fd == -1)
+    return true;
+
+  char **dirs = watched_dirs();
+  if (!dirs)
+    return true;
+  watch_missing(dirs, index);
+
+  bool in_sync = true;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(inotify_fd, buf, sizeof(buf))) > 0)
+  {
+    for (char *p = buf; p < buf + len;)
+    {
+      struct inotify_event *event = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        in_sync = false;
+        continue;
+      }
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        in_sync = false;
+        continue;
+      }
+      if (event->mask & IN_IGNORED)
+      {
+        // The watch is gone with its directory; watch_missing() retries
+        for (int i = 0; i < watched_count; i++)
+        {
+          if (watched[i].wd == event->wd)
+            watched[i].wd = -1;
+        }
+        continue;
+      }
+      if (event->len == 0 || (event->mask & IN_ISDIR) || dir_for_wd(event->wd) == NULL)
+        continue;
+
+      refresh_name(event->name, dirs, watched_count, index);
+    }
+  }
+
+  free(dirs);
+  return in_sync;
+}
+
+static int find_dir(const WatchedDir *dirs, int count, const char *dir)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (strcmp(dirs[i].dir, dir) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Switch to a new PATH. Only directories that were added or removed are
+// read; directories present in both keep their watches untouched.
+bool pathwatch_set_path(char **path_tokens, int path_count, CompletionIndex *index)
+{
+  if (inotify_fd == -1)
+    return pathwatch_start(path_tokens, path_count);
+
+  int new_count = 0;
+  WatchedDir *new_watched = build_watches(path_tokens, path_count, &new_count);
+  if (!new_watched)
+    return false;
+
+  // Keep watches of surviving directories and check their relative order
+  bool reordered = false;
+  int last_old = -1;
+  for (int i = 0; i < new_count; i++)
+  {
+    int old = find_dir(watched, watched_count, new_watched[i].dir);
+    if (old == -1)
+      continue;
+    new_watched[i].wd = watched[old].wd;
+    watched[old].wd = -1;
+    if (old < last_old)
+      reordered = true;
+    last_old = old;
+  }
+
+  WatchedDir *old_watched = watched;
+  int old_count = watched_count;
+  watched = new_watched;
+  watched_count = new_count;
+
+  char **dirs = watched_dirs();
+  if (!dirs)
+  {
+    free_watched(old_watched, old_count);
+    return false;
+  }
+
+  for (int i = 0; i < old_count; i++)
+  {
+    if (find_dir(new_watched, new_count, old_watched[i].dir) != -1)
+      continue;
+    if (old_watched[i].wd != -1 && !wd_in_use(new_watched, new_count, old_watched[i].wd))
+      inotify_rm_watch(inotify_fd, old_watched[i].wd);
+    refresh_directory(old_watched[i].dir, dirs, new_count, index);
+  }
+  for (int i = 0; i < new_count; i++)
+  {
+    if (new_watched[i].wd != -1 || find_dir(old_watched, old_count, new_watched[i].dir) != -1)
+      continue;
+    new_watched[i].wd = inotify_add_watch(inotify_fd, new_watched[i].dir, WATCH_MASK);
+    refresh_directory(new_watched[i].dir, dirs, new_count, index);
+  }
+
+  // Resolution order changed for names in more than one surviving directory
+  if (reordered)
+    cmdhash_reset();
+
+  free(dirs);
+  free_watched(old_watched, old_count);
+  return true;
+}
+
+void pathwatch_stop(void)
+{
+  if (inotify_fd != -1)
+    close(inotify_fd);
+  inotify_fd = -1;
+  free_watched(watched, watched_count);
+  watched = NULL;
+  watched_count = 0;
+}
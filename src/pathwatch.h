@@ -0,0 +1,16 @@
+#ifndef PATHWATCH_H
+#define PATHWATCH_H
+
+#include <stdbool.h>
+
+#include "complete.h"
+
+// Keeps the completion index and the command-location cache in sync with
+// the PATH directories through inotify, one changed name at a time.
+
+bool pathwatch_start(char **path_tokens, int path_count);
+bool pathwatch_process(CompletionIndex *index);
+bool pathwatch_set_path(char **path_tokens, int path_count, CompletionIndex *index);
+void pathwatch_stop(void);
+
+#endif
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include "redirect.h"
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Keep saved descriptors clear of the ones builtins and children use
+#define SAVED_FD_MIN 10
+
+// Put a here-document or here-string in an anonymous memory file and
+// return it rewound: the reader gets a seekable, mappable stdin of any
+// size, and nothing has to write it while the command runs, as it would
+// into a pipe.
+static int open_text(const char *text)
+{
+  int fd = memfd_create("heredoc", MFD_CLOEXEC);
+  if (fd == -1)
+  {
+    perror("memfd_create");
+    return -1;
+  }
+  if (!write_all(fd, text, strlen(text)) || lseek(fd, 0, SEEK_SET) == -1)
+  {
+    perror("here-document");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Open the file or here-document of `step`, close-on-exec and above
+// `max_target`. Returns -1 after reporting a failure.
+static int open_step(const RedirectionStep *step, int max_target)
+{
+  int fd;
+  if (step->type == REDIRECT_TEXT)
+  {
+    fd = open_text(step->word);
+  }
+  else
+  {
+    int flags = O_CLOEXEC;
+    if (step->type == REDIRECT_INPUT)
+      flags |= O_RDONLY;
+    else
+      flags |= O_WRONLY | O_CREAT | (step->type == REDIRECT_APPEND ? O_APPEND : O_TRUNC);
+    fd = open(step->word, flags, 0644);
+    if (fd == -1)
+      fprintf(stderr, "%s: %s\n", step->word, strerror(errno));
+  }
+
+  if (fd != -1 && fd <= max_target)
+  {
+    // An earlier move onto this number would replace the file first
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, max_target + 1);
+    if (high == -1)
+      perror("fcntl");
+    close(fd);
+    fd = high;
+  }
+  return fd;
+}
+
+// Whether `fd` is open for a command once the moves so far are made:
+// `state` says if one of them set (1) or closed (-1) it; otherwise it is
+// inherited, and the shell's own descriptors are close-on-exec.
+static bool is_visible(int fd, const signed char *state)
+{
+  if (fd <= REDIRECT_MAX_FD && state[fd] != 0)
+    return state[fd] > 0;
+  int flags = fcntl(fd, F_GETFD);
+  return flags != -1 && !(flags & FD_CLOEXEC);
+}
+
+// Open everything `redir` needs and describe it as moves, malloc'd into
+// `*moves` (NULL without redirections). Returns false, having reported
+// why and closed what it opened, if a file cannot be opened or a
+// descriptor to copy is not open.
+bool redirect_open(const Redirection *redir, FdMove **moves)
+{
+  *moves = NULL;
+  if (redir == NULL || redir->count == 0)
+    return true;
+
+  FdMove *list = malloc(redir->count * sizeof(FdMove));
+  if (list == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  int max_target = 0;
+  for (int i = 0; i < redir->count; i++)
+  {
+    if (redir->steps[i].fd > max_target)
+      max_target = redir->steps[i].fd;
+  }
+
+  signed char state[REDIRECT_MAX_FD + 1] = {0};
+  for (int i = 0; i < redir->count; i++)
+  {
+    const RedirectionStep *step = &redir->steps[i];
+    FdMove *move = &list[i];
+    move->to = step->fd;
+    move->owned = step->type != REDIRECT_DUP;
+    move->from = move->owned ? open_step(step, max_target) : step->source_fd;
+
+    bool ok = move->owned ? move->from != -1 : move->from == -1 || is_visible(move->from, state);
+    if (!ok)
+    {
+      if (!move->owned)
+        fprintf(stderr, "%d: Bad file descriptor\n", move->from);
+      redirect_close(list, i);
+      return false;
+    }
+    state[move->to] = move->from != -1 ? 1 : -1;
+  }
+  *moves = list;
+  return true;
+}
+
+// Close the descriptors opened for the first `count` moves and free them.
+void redirect_close(FdMove *moves, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (moves[i].owned)
+      close(moves[i].from);
+  }
+  free(moves);
+}
+
+// Make `moves` on the shell's own descriptors, saving each one about to
+// be replaced into `saved` (room for REDIRECT_SAVED_MAX) the first time.
+// Returns false if a move fails; what was done can still be restored.
+bool redirect_apply(const FdMove *moves, int count, SavedFd *saved, int *saved_count)
+{
+  *saved_count = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int fd = moves[i].to;
+    int j = 0;
+    while (j < *saved_count && saved[j].fd != fd)
+      j++;
+    if (j == *saved_count)
+      saved[(*saved_count)++] = (SavedFd){fd, fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN)};
+
+    if (moves[i].from == -1)
+    {
+      close(fd);
+    }
+    else if (dup2(moves[i].from, fd) == -1)
+    {
+      perror("dup2");
+      return false;
+    }
+  }
+  return true;
+}
+
+// Put back every descriptor redirect_apply() replaced.
+void redirect_restore(const SavedFd *saved, int saved_count)
+{
+  for (int i = saved_count - 1; i >= 0; i--)
+  {
+    if (saved[i].saved != -1)
+    {
+      dup2(saved[i].saved, saved[i].fd);
+      close(saved[i].saved);
+    }
+    else
+    {
+      close(saved[i].fd); // Was closed before the redirection too
+    }
+  }
+}
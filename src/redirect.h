@@ -0,0 +1,38 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <stdbool.h>
+
+#include "shell.h"
+
+// Redirections become a list of descriptor moves, applied in order after
+// a pipeline's own dup2s. The shell opens every file and here-document
+// itself, close-on-exec, so a bad path is reported before anything runs;
+// an opened descriptor is kept above every descriptor a redirection names
+// so that no move clobbers it before its own turn. A child gets the moves
+// as posix_spawn file actions or dup2 calls after fork; a builtin has them
+// applied to the shell's descriptors and undone when it is done.
+
+typedef struct
+{
+  int from;   // Descriptor copied onto `to`, or -1 to close `to`
+  int to;
+  bool owned; // Opened for the move; redirect_close() closes it
+} FdMove;
+
+// A descriptor a builtin's redirections replaced
+typedef struct
+{
+  int fd;
+  int saved; // Copy of `fd` from before, or -1 if it was closed
+} SavedFd;
+
+// Room for one of each descriptor a redirection can name
+#define REDIRECT_SAVED_MAX (REDIRECT_MAX_FD + 1)
+
+bool redirect_open(const Redirection *redir, FdMove **moves);
+void redirect_close(FdMove *moves, int count);
+bool redirect_apply(const FdMove *moves, int count, SavedFd *saved, int *saved_count);
+void redirect_restore(const SavedFd *saved, int saved_count);
+
+#endif
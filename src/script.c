@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+
+#include "script.h"
+#include "scriptcache.h"
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCRIPT_BLOCK_SIZE 65536
+
+// Whether a command may go on past its first line: it opens
+// here-documents, perhaps an if or a loop, or ends in | or &&/||. Errs on
+// the side of yes; command_extent() has the final say.
+static bool may_continue(const char *line, size_t length)
+{
+  while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t'))
+    length--;
+  if (length > 0 && (line[length - 1] == '|' || line[length - 1] == '&'))
+    return true;
+  return memmem(line, length, "<<", 2) != NULL || memmem(line, length, "if", 2) != NULL ||
+         memmem(line, length, "for", 3) != NULL || memmem(line, length, "while", 5) != NULL ||
+         memmem(line, length, "until", 5) != NULL;
+}
+
+// Length of the command at the start of `text`, without its final
+// newline: one line, or through the last line of its here-documents, of
+// the if or loop it opens, or of a pipeline or list it continues on the
+// next line. Returns false if it may go on past `size` and `at_end` is not
+// set; at the end a final line needs no newline and anything left open is
+// the parser's to report.
+bool next_command(const char *text, size_t size, bool at_end, Arena *arena, size_t *length)
+{
+  const char *newline = memchr(text, '\n', size);
+  if (newline == NULL)
+  {
+    *length = size;
+    return at_end;
+  }
+
+  *length = newline - text;
+  if (may_continue(text, *length))
+  {
+    // The lines after this one may belong to the command
+    size_t extent = command_extent(text, size, arena);
+    if (extent == 0 && !at_end)
+      return false;
+    *length = extent != 0 ? extent : size;
+  }
+  return true;
+}
+
+// While run_script_fd() runs a command: the file it reads and the shell
+// process reading it, and the part of the block after the command, read
+// but not run yet
+static bool reading_script = false;
+static struct stat script_st;
+static pid_t script_pid;
+static const char *unread_text = NULL;
+static size_t unread_size = 0;
+static bool unread_taken = false;
+
+// Run every complete command in `text`. Returns how many bytes were used,
+// all of them if a command took the rest of the script as its input.
+static size_t run_lines(const char *text, size_t size, bool at_end, Arena *arena)
+{
+  size_t start = 0;
+  size_t length;
+  while (start < size && next_command(text + start, size - start, at_end, arena, &length))
+  {
+    size_t next = length < size - start ? start + length + 1 : start + length;
+    unread_text = text + next;
+    unread_size = size - next;
+    execute_line(text + start, length, arena);
+    if (unread_taken)
+      return size;
+    start = next;
+  }
+  return start;
+}
+
+// For a builtin about to read stdin to the end: if stdin is the script
+// being read, the part of it already read past the running command, which
+// comes before anything still to be read from the descriptor. The script
+// stops after this command, as if it had been read no further than that
+// command, the way other shells read a script on stdin. NULL otherwise,
+// and always in a forked pipeline stage, which cannot stop the script.
+const char *script_take_stdin(size_t *size)
+{
+  struct stat stdin_st;
+  if (!reading_script || getpid() != script_pid || fstat(STDIN_FILENO, &stdin_st) == -1 ||
+      script_st.st_dev != stdin_st.st_dev || script_st.st_ino != stdin_st.st_ino)
+    return NULL;
+  unread_taken = true;
+  *size = unread_size;
+  return unread_text;
+}
+
+// Read `fd` in large blocks, carrying a partial last line over to the
+// next read. Commands run by the script do not see the rest of it on
+// their stdin, except a builtin that takes it with script_take_stdin().
+void run_script_fd(int fd, Arena *arena)
+{
+  size_t capacity = SCRIPT_BLOCK_SIZE;
+  size_t size = 0;
+  char *buffer = malloc(capacity);
+  if (buffer == NULL)
+  {
+    perror("Memory allocation failed");
+    return;
+  }
+
+  reading_script = fstat(fd, &script_st) == 0;
+  script_pid = getpid();
+  while (!unread_taken)
+  {
+    if (size == capacity)
+    {
+      // One line longer than the buffer
+      char *tmp = realloc(buffer, capacity * 2);
+      if (tmp == NULL)
+      {
+        perror("Memory allocation failed");
+        break;
+      }
+      buffer = tmp;
+      capacity *= 2;
+    }
+
+    ssize_t got = read(fd, buffer + size, capacity - size);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got == -1)
+      perror("read");
+    if (got <= 0)
+    {
+      run_lines(buffer, size, true, arena);
+      break;
+    }
+
+    size += got;
+    size_t used = run_lines(buffer, size, false, arena);
+    memmove(buffer, buffer + used, size - used);
+    size -= used;
+  }
+  reading_script = false;
+  unread_taken = false;
+  free(buffer);
+}
+
+// Run the script's cached compiled form, or else map the whole script and
+// run it in place. Anything that cannot be mapped (a FIFO, /dev/stdin) is
+// read in blocks instead. Returns 127 if the script cannot be opened,
+// otherwise 0.
+int run_script_file(const char *path, Arena *arena)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 127;
+  }
+
+  struct stat st;
+  bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  if (regular && run_cached_script(path, fd, &st, arena))
+  {
+    close(fd);
+    return 0;
+  }
+  if (regular)
+  {
+    if (st.st_size > 0)
+    {
+      char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (text != MAP_FAILED)
+      {
+        close(fd);
+        madvise(text, st.st_size, MADV_SEQUENTIAL);
+        run_lines(text, st.st_size, true, arena);
+        munmap(text, st.st_size);
+        return 0;
+      }
+    }
+    else
+    {
+      close(fd);
+      return 0;
+    }
+  }
+
+  run_script_fd(fd, arena);
+  close(fd);
+  return 0;
+}
+
+void run_script_string(const char *text, Arena *arena)
+{
+  run_lines(text, strlen(text), true, arena);
+}
@@ -0,0 +1,20 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+// Non-interactive input: a script file, a -c string or piped stdin.
+// Commands, a line each or several for an if or a loop, are handed to
+// execute_line() back to back, without readline, the prompt or any of the
+// completion machinery.
+
+bool next_command(const char *text, size_t size, bool at_end, Arena *arena, size_t *length);
+int run_script_file(const char *path, Arena *arena);
+void run_script_fd(int fd, Arena *arena);
+void run_script_string(const char *text, Arena *arena);
+const char *script_take_stdin(size_t *size);
+
+#endif
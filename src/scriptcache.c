@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+
+#include "scriptcache.h"
+#include "hash.h"
+#include "output.h"
+#include "script.h"
+#include "shell.h"
+#include "tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "shcache4" // Changed whenever the layout below or the lexer's output changes
+
+typedef struct
+{
+  char magic[8];
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t path_length; // The script's absolute path follows, NUL-terminated
+  uint32_t reserved;
+} CacheHeader;
+
+// After the path, each command is a uint32_t word count, one byte per
+// word for its token kind, then its first line and its words, each
+// NUL-terminated and with its $ expansions marked, not made. A command
+// that spans several lines is one record, its lines separated by
+// TOKEN_NEWLINE words.
+typedef struct
+{
+  uint32_t arg_count;
+  const unsigned char *kinds;
+  const char *text;
+  const char *words; // arg_count strings, back to back
+} Record;
+
+char *script_cache_dir = NULL;
+
+// SHELL_SCRIPT_CACHE, else $XDG_CACHE_HOME/shell-in-c, else
+// ~/.cache/shell-in-c. An empty SHELL_SCRIPT_CACHE turns caching off.
+void script_cache_init(void)
+{
+  const char *dir = getenv("SHELL_SCRIPT_CACHE");
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int length = 0;
+  if (dir != NULL)
+    script_cache_dir = *dir != '\0' ? strdup(dir) : NULL;
+  else if (xdg != NULL && *xdg != '\0')
+    length = asprintf(&script_cache_dir, "%s/shell-in-c", xdg);
+  else if (home != NULL && *home != '\0')
+    length = asprintf(&script_cache_dir, "%s/.cache/shell-in-c", home);
+  if (length == -1)
+    script_cache_dir = NULL;
+}
+
+// The cache file for `abs_path`: its FNV-1a hash, in hex.
+static char *cache_file(const char *abs_path)
+{
+  char *file;
+  if (asprintf(&file, "%s/%016llx.shc", script_cache_dir, (unsigned long long)hash_string(abs_path)) == -1)
+    return NULL;
+  return file;
+}
+
+static void fill_header(CacheHeader *header, const struct stat *st, const char *abs_path)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+  header->dev = st->st_dev;
+  header->ino = st->st_ino;
+  header->size = st->st_size;
+  header->mtime_sec = st->st_mtim.tv_sec;
+  header->mtime_nsec = st->st_mtim.tv_nsec;
+  header->path_length = strlen(abs_path);
+}
+
+// Read the record at `*p` and move past it. Returns false if it is cut
+// off before `end` or holds a token kind there is no such thing as.
+static bool read_record(const char **p, const char *end, Record *record)
+{
+  if (end - *p < (ptrdiff_t)sizeof(uint32_t))
+    return false;
+  memcpy(&record->arg_count, *p, sizeof(uint32_t));
+  const char *q = *p + sizeof(uint32_t);
+  if ((size_t)(end - q) < record->arg_count)
+    return false;
+  record->kinds = (const unsigned char *)q;
+  for (uint32_t i = 0; i < record->arg_count; i++)
+  {
+    if (record->kinds[i] > TOKEN_RESERVED)
+      return false;
+  }
+  q += record->arg_count;
+
+  // The first line, then the words
+  record->text = q;
+  for (uint32_t i = 0; i <= record->arg_count; i++)
+  {
+    const char *nul = memchr(q, '\0', end - q);
+    if (nul == NULL)
+      return false;
+    q = nul + 1;
+    if (i == 0)
+      record->words = q;
+  }
+  *p = q;
+  return true;
+}
+
+// Map `file` if it is the compiled form of the script `st` describes and
+// every record in it is whole. Returns the mapping, or NULL.
+static char *map_cache(const char *file, const struct stat *st, const char *abs_path, size_t *size)
+{
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  struct stat cache_st;
+  if (fstat(fd, &cache_st) == -1 || (size_t)cache_st.st_size < sizeof(CacheHeader))
+  {
+    close(fd);
+    return NULL;
+  }
+  *size = cache_st.st_size;
+  char *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  CacheHeader expected, header;
+  fill_header(&expected, st, abs_path);
+  memcpy(&header, map, sizeof(header));
+  size_t body = sizeof(header) + expected.path_length + 1;
+  bool ok = memcmp(&header, &expected, sizeof(header)) == 0 && *size >= body &&
+            memcmp(map + sizeof(header), abs_path, expected.path_length + 1) == 0;
+
+  Record record;
+  for (const char *p = map + body; ok && p < map + *size;)
+    ok = read_record(&p, map + *size, &record);
+  if (!ok)
+  {
+    munmap(map, *size);
+    return NULL;
+  }
+  return map;
+}
+
+static Command *build_command(const Record *record, Arena *arena)
+{
+  Command *cmd = arena_alloc(arena, sizeof(Command));
+  char **args = arena_alloc(arena, (record->arg_count + 1) * sizeof(char *));
+  TokenKind *kinds = arena_alloc(arena, (record->arg_count + 1) * sizeof(TokenKind));
+  if (cmd == NULL || args == NULL || kinds == NULL)
+    return NULL;
+
+  // The words are used where they are mapped; nothing writes to them
+  const char *word = record->words;
+  for (uint32_t i = 0; i < record->arg_count; i++)
+  {
+    args[i] = (char *)word;
+    kinds[i] = record->kinds[i];
+    word += strlen(word) + 1;
+  }
+  args[record->arg_count] = NULL;
+
+  cmd->name = args[0];
+  cmd->args = args;
+  cmd->arg_count = record->arg_count;
+  cmd->kinds = kinds;
+  cmd->text = record->text;
+  cmd->background = false;
+  return cmd;
+}
+
+// Run the compiled commands in `body`, which has been checked.
+static void run_compiled(const char *body, const char *end, Arena *arena)
+{
+  Record record;
+  for (const char *p = body; p < end && read_record(&p, end, &record);)
+  {
+    Command *cmd = build_command(&record, arena);
+    if (cmd == NULL)
+    {
+      perror("Memory allocation failed");
+      record_status(1);
+      arena_reset(arena);
+      continue;
+    }
+    execute_parsed(cmd, arena);
+  }
+}
+
+static void write_record(FILE *out, const Command *cmd)
+{
+  uint32_t count = cmd->arg_count;
+  fwrite(&count, sizeof(count), 1, out);
+  for (int i = 0; i < cmd->arg_count; i++)
+    fputc(cmd->kinds[i], out);
+  fwrite(cmd->text, strlen(cmd->text) + 1, 1, out);
+  for (int i = 0; i < cmd->arg_count; i++)
+    fwrite(cmd->args[i], strlen(cmd->args[i]) + 1, 1, out);
+}
+
+// Parse every command in `text` into records on `out`, quietly. Returns
+// false as soon as the parser complains; running the script line by line
+// then reports it where it happens.
+static bool compile(const char *text, size_t size, FILE *out, Arena *arena)
+{
+  parse_quiet = true;
+  parse_complained = false;
+  bool ok = true;
+  size_t start = 0;
+  size_t length;
+  while (ok && start < size && next_command(text + start, size - start, true, arena, &length))
+  {
+    char *input = arena_alloc(arena, length + 1);
+    Command *cmd = NULL;
+    Node *tree;
+    if (input != NULL)
+    {
+      memcpy(input, text + start, length);
+      input[length] = '\0';
+      cmd = parse_command(input, arena);
+    }
+    ok = cmd != NULL && parse_tree(cmd, &tree, arena) && !parse_complained;
+    if (ok && cmd->arg_count > 0)
+      write_record(out, cmd);
+    arena_reset(arena);
+    start += length < size - start ? length + 1 : length;
+  }
+  parse_quiet = false;
+  return ok;
+}
+
+// Write the cache file under a temporary name and rename it into place,
+// so a concurrent run sees either no file or a whole one. Failing is not
+// an error: the script just gets compiled again next time.
+static void store(const char *file, const CacheHeader *header, const char *abs_path, const char *body,
+                  size_t body_size)
+{
+  char *parent = strdup(script_cache_dir);
+  char *slash = parent != NULL ? strrchr(parent, '/') : NULL;
+  if (slash != NULL && slash != parent)
+  {
+    *slash = '\0';
+    mkdir(parent, 0700);
+  }
+  free(parent);
+  mkdir(script_cache_dir, 0700);
+
+  char *tmp;
+  if (asprintf(&tmp, "%s.%d", file, (int)getpid()) == -1)
+    return;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd != -1)
+  {
+    bool ok = write_all(fd, (const char *)header, sizeof(*header)) &&
+              write_all(fd, abs_path, header->path_length + 1) && write_all(fd, body, body_size);
+    if (close(fd) == -1 || !ok || rename(tmp, file) == -1)
+      unlink(tmp);
+  }
+  free(tmp);
+}
+
+// Run the regular file `path` (open as `fd`) from its compiled form,
+// compiling and caching it first if need be. Returns false, having run
+// nothing, if it cannot be compiled.
+bool run_cached_script(const char *path, int fd, const struct stat *st, Arena *arena)
+{
+  if (script_cache_dir == NULL || st->st_size == 0)
+    return false;
+  char *abs_path = realpath(path, NULL);
+  char *file = abs_path != NULL ? cache_file(abs_path) : NULL;
+  if (file == NULL)
+  {
+    free(abs_path);
+    return false;
+  }
+
+  size_t map_size;
+  char *map = map_cache(file, st, abs_path, &map_size);
+  if (map != NULL)
+  {
+    size_t body = sizeof(CacheHeader) + strlen(abs_path) + 1;
+    run_compiled(map + body, map + map_size, arena);
+    munmap(map, map_size);
+    free(file);
+    free(abs_path);
+    return true;
+  }
+
+  bool ok = false;
+  char *text = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  char *body = NULL;
+  size_t body_size = 0;
+  FILE *out = text != MAP_FAILED ? open_memstream(&body, &body_size) : NULL;
+  if (out != NULL)
+  {
+    madvise(text, st->st_size, MADV_SEQUENTIAL);
+    ok = compile(text, st->st_size, out, arena);
+    ok = fclose(out) == 0 && ok;
+  }
+  if (text != MAP_FAILED)
+    munmap(text, st->st_size);
+
+  if (ok)
+  {
+    // Another write within the same clock tick would leave the mtime as
+    // it is, so a script that has only just changed is not cached yet
+    CacheHeader header;
+    fill_header(&header, st, abs_path);
+    if (st->st_mtim.tv_sec < time(NULL) - 1)
+      store(file, &header, abs_path, body, body_size);
+    run_compiled(body, body + body_size, arena);
+  }
+  free(body);
+  free(file);
+  free(abs_path);
+  return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef SCRIPTCACHE_H
+#define SCRIPTCACHE_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+
+// Compiled scripts. A script file is parsed once, ahead of running it,
+// into a flat list of commands: each one's token kinds and its words with
+// quotes removed and here-documents filled in. That is written to a cache
+// directory, keyed by the script's absolute path and checked against its
+// device, inode, size and mtime, and later runs map it and build each
+// Command straight from the mapped words, never tokenizing again. The
+// tree of a list, if or loop is built from those tokens on each run, a
+// scan with no lexing. Scripts the parser complains about are not
+// compiled.
+
+extern char *script_cache_dir; // NULL when caching is off
+
+void script_cache_init(void);
+bool run_cached_script(const char *path, int fd, const struct stat *st, Arena *arena);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdbool.h>
+
+#include "arena.h"
+
+typedef enum
+{
+  TOKEN_WORD,    // Argument, with quotes and escapes already removed and $ expansions marked
+  TOKEN_PIPE,    // |
+  TOKEN_REDIRECT,  // [n]>, [n]>>, [n]<, [n]>&, [n]<&, &>, &>>, <<, <<-, <<<
+  TOKEN_BACKGROUND, // &
+  TOKEN_AND,     // &&
+  TOKEN_OR,      // ||
+  TOKEN_SEMI,    // ;
+  TOKEN_NEWLINE, // Between the lines of a command that spans several
+  TOKEN_RESERVED // Unquoted if, then, elif, else, fi, for, in, do, done, while or until
+} TokenKind;
+
+typedef struct
+{
+  char *name;
+  char **args;
+  int arg_count;
+  TokenKind *kinds; // Kind of each entry in args; operators keep their text
+  const char *text; // The first line as typed, for the job table
+  bool background;  // Ended in "&", which is not part of args; set by parse_tree()
+} Command;
+
+// How the lexer leaves $NAME and ${NAME} in a word, for expand_command()
+// to fill in each time the command runs: the name between EXPAND_UNQUOTED
+// (or EXPAND_QUOTED inside double quotes) and EXPAND_END. Anywhere else
+// EXPAND_END makes the byte after it literal, so a word can still hold
+// these bytes. The name is a variable name, a digit, ? or $.
+#define EXPAND_UNQUOTED '\x01'
+#define EXPAND_QUOTED '\x02'
+#define EXPAND_END '\x03'
+#define EXPAND_MARKS "\x01\x02\x03"
+
+// Highest descriptor a redirection can name, as POSIX only requires 0-9
+#define REDIRECT_MAX_FD 9
+
+typedef enum
+{
+  REDIRECT_OUTPUT, // [n]>, and the first half of &>
+  REDIRECT_APPEND, // [n]>>
+  REDIRECT_INPUT,  // [n]<
+  REDIRECT_DUP,    // [n]>&m, [n]<&m, [n]>&-, and the 2>&1 half of &>
+  REDIRECT_TEXT    // <<, <<-, <<<
+} RedirectionType;
+
+typedef struct
+{
+  RedirectionType type;
+  int fd;           // Descriptor it replaces
+  const char *word; // File name, or a here-document's text
+  int source_fd;    // REDIRECT_DUP: descriptor copied, -1 to close `fd`
+} RedirectionStep;
+
+// A command's redirections, applied in order
+typedef struct
+{
+  RedirectionStep *steps;
+  int count;
+  int operator_index; // First redirection operator, after all the arguments; -1 for none
+} Redirection;
+
+// Exit status of the last command, and of every stage of the last
+// pipeline (like bash's $? and PIPESTATUS).
+extern int last_status;
+extern int *pipe_status;
+extern int pipe_status_count;
+
+// main.c
+bool is_builtin(const char *name);
+void execute_command(const Command *cmd, const Redirection *redir, Arena *arena);
+void execute_line(const char *line, size_t length, Arena *arena);
+void execute_parsed(Command *cmd, Arena *arena);
+void not_found(const char *command);
+
+// parse.c: no dependencies beyond the arena, so benchmarks link it alone.
+// parse_command() returns NULL after reporting a syntax error. A line
+// that opens here-documents is followed by their bodies in `input`, and
+// a command goes on over further lines while an if, for, while or until
+// is open or a line ends in |, && or ||; command_extent() tells a reader
+// of raw input how far that goes; unexpanded_word() turns the marks of a
+// word back into the $NAMEs they stand for. With parse_quiet set nothing
+// is reported; parse_complained still records that there was an error or
+// warning.
+extern bool parse_quiet;
+extern bool parse_complained;
+void parse_complain(const char *format, ...);
+Command *parse_command(const char *input, Arena *arena);
+const char *unexpanded_word(const char *word, Arena *arena);
+size_t command_extent(const char *text, size_t size, Arena *arena);
+bool has_pipeline(const Command *cmd);
+bool parse_redirection(const Command *cmd, Redirection *redir, Arena *arena);
+void print_debug_info(const Command *cmd);
+
+// exec.c
+extern bool batch_args; // Split argument lists over ARG_MAX into several runs
+int decode_status(int status);
+void record_status(int status);
+int execute_program(const Command *cmd, const Redirection *redir, Arena *arena);
+int execute_timeout(char **argv, long long timeout_ms, const char *text);
+void execute_pipeline(const Command *cmd, Arena *arena);
+
+#endif
@@ -0,0 +1,148 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_CAPACITY 65536
+#define MAX_PHASES 32
+
+typedef struct
+{
+  const char *name; // A string literal
+  long long start_ns;
+  long long duration_ns;
+  int stage; // Pipeline stage, -1 for none
+} TraceEvent;
+
+typedef struct
+{
+  const char *name;
+  unsigned long count;
+  long long total_ns;
+  long long max_ns;
+} PhaseTotals;
+
+bool tracing = false;
+
+static TraceEvent *ring = NULL;
+static unsigned long long recorded = 0;
+static char *trace_path = NULL;
+static pid_t shell_pid; // Forked builtin stages must not write the file
+
+static long long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void dump_at_exit(void)
+{
+  if (getpid() == shell_pid)
+    trace_dump(trace_path);
+}
+
+void trace_init(const char *path)
+{
+  ring = malloc(TRACE_CAPACITY * sizeof(TraceEvent));
+  trace_path = strdup(path);
+  if (ring == NULL || trace_path == NULL)
+  {
+    perror("Memory allocation failed");
+    free(ring);
+    free(trace_path);
+    return;
+  }
+  shell_pid = getpid();
+  tracing = true;
+  atexit(dump_at_exit);
+}
+
+// Start of a phase; 0 when tracing is off.
+long long trace_begin(void)
+{
+  return tracing ? now_ns() : 0;
+}
+
+void trace_end(const char *name, long long start_ns, int stage)
+{
+  if (!tracing)
+    return;
+  TraceEvent *event = &ring[recorded++ % TRACE_CAPACITY];
+  event->name = name;
+  event->start_ns = start_ns;
+  event->duration_ns = now_ns() - start_ns;
+  event->stage = stage;
+}
+
+static unsigned long long oldest_event(void)
+{
+  return recorded > TRACE_CAPACITY ? recorded - TRACE_CAPACITY : 0;
+}
+
+// Write the buffer, oldest event first, as complete ("X") events with
+// microsecond timestamps.
+bool trace_dump(const char *path)
+{
+  FILE *file = fopen(path, "we");
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (unsigned long long i = oldest_event(); i < recorded; i++)
+  {
+    const TraceEvent *event = &ring[i % TRACE_CAPACITY];
+    fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+            i == oldest_event() ? "" : ",\n", event->name, event->start_ns / 1000.0, event->duration_ns / 1000.0,
+            (int)shell_pid, (int)shell_pid);
+    if (event->stage >= 0)
+      fprintf(file, ",\"args\":{\"stage\":%d}", event->stage);
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  bool ok = !ferror(file);
+  if (fclose(file) != 0 || !ok)
+  {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+
+// Count, total, mean and worst time per phase over the buffer.
+void trace_summary(FILE *out)
+{
+  PhaseTotals phases[MAX_PHASES];
+  int phase_count = 0;
+
+  for (unsigned long long i = oldest_event(); i < recorded; i++)
+  {
+    const TraceEvent *event = &ring[i % TRACE_CAPACITY];
+    int p = 0;
+    while (p < phase_count && strcmp(phases[p].name, event->name) != 0)
+      p++;
+    if (p == phase_count)
+    {
+      if (phase_count == MAX_PHASES)
+        continue;
+      phases[phase_count++] = (PhaseTotals){event->name, 0, 0, 0};
+    }
+    phases[p].count++;
+    phases[p].total_ns += event->duration_ns;
+    if (event->duration_ns > phases[p].max_ns)
+      phases[p].max_ns = event->duration_ns;
+  }
+
+  fprintf(out, "%-18s %8s %12s %10s %10s\n", "phase", "count", "total us", "mean us", "max us");
+  for (int p = 0; p < phase_count; p++)
+  {
+    fprintf(out, "%-18s %8lu %12.1f %10.2f %10.1f\n", phases[p].name, phases[p].count, phases[p].total_ns / 1000.0,
+            phases[p].total_ns / 1000.0 / phases[p].count, phases[p].max_ns / 1000.0);
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Opt-in latency tracing of the shell's own work (SHELL_TRACE=FILE): parse,
+// redirection parsing, PATH lookup, spawn, redirection setup and wait.
+// Phases are recorded with CLOCK_MONOTONIC timestamps into a fixed ring
+// buffer, so a long session keeps the latest TRACE_CAPACITY of them at a
+// constant cost. The buffer is written to FILE as Chrome trace-event JSON
+// (chrome://tracing, Perfetto) when the shell exits, or by the `trace`
+// builtin at any time.
+//
+//   long long start = trace_begin();
+//   ...
+//   trace_end("parse", start, -1);
+
+extern bool tracing;
+
+void trace_init(const char *path);
+long long trace_begin(void);
+void trace_end(const char *name, long long start_ns, int stage);
+bool trace_dump(const char *path);
+void trace_summary(FILE *out);
+
+#endif
@@ -0,0 +1,418 @@
+#include "tree.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+// Recursive descent over the token stream of one command
+typedef struct
+{
+  Command *tokens;
+  int pos;
+  Arena *arena;
+} Parser;
+
+static Node *parse_node(Parser *p);
+
+static bool at_end(const Parser *p)
+{
+  return p->pos >= p->tokens->arg_count;
+}
+
+static TokenKind next_kind(const Parser *p)
+{
+  return p->tokens->kinds[p->pos];
+}
+
+// Whether the next token is the reserved word `word`
+static bool at_keyword(const Parser *p, const char *word)
+{
+  return !at_end(p) && next_kind(p) == TOKEN_RESERVED && strcmp(p->tokens->args[p->pos], word) == 0;
+}
+
+// A reserved word that ends the list in front of it
+static bool at_list_end(const Parser *p)
+{
+  return at_keyword(p, "then") || at_keyword(p, "elif") || at_keyword(p, "else") || at_keyword(p, "fi") ||
+         at_keyword(p, "do") || at_keyword(p, "done");
+}
+
+static void skip_newlines(Parser *p)
+{
+  while (!at_end(p) && next_kind(p) == TOKEN_NEWLINE)
+    p->pos++;
+}
+
+static bool unexpected(const Parser *p)
+{
+  if (at_end(p))
+    parse_complain("syntax error: unexpected end of file\n");
+  else
+    parse_complain("syntax error near unexpected token `%s'\n",
+                   next_kind(p) == TOKEN_NEWLINE ? "newline" : p->tokens->args[p->pos]);
+  return false;
+}
+
+static bool expect(Parser *p, const char *word)
+{
+  if (!at_keyword(p, word))
+    return unexpected(p);
+  p->pos++;
+  return true;
+}
+
+static Node *new_node(Parser *p, NodeKind kind)
+{
+  Node *node = arena_alloc(p->arena, sizeof(Node));
+  if (node == NULL)
+  {
+    perror("Memory allocation failed");
+    return NULL;
+  }
+  memset(node, 0, sizeof(*node));
+  node->kind = kind;
+  node->link = LINK_NEXT;
+  node->redir.operator_index = -1;
+  return node;
+}
+
+// Tokens a pipeline stops at
+static bool ends_pipeline(TokenKind kind)
+{
+  return kind == TOKEN_SEMI || kind == TOKEN_NEWLINE || kind == TOKEN_BACKGROUND || kind == TOKEN_AND ||
+         kind == TOKEN_OR;
+}
+
+// The words of a command joined by spaces, $NAMEs as typed, for the job
+// table
+static const char *join_words(char **args, int count, Arena *arena)
+{
+  size_t length = 1;
+  for (int i = 0; i < count; i++)
+    length += strlen(args[i]) + 1;
+  char *text = arena_alloc(arena, length);
+  if (text == NULL)
+    return "";
+  char *out = text;
+  for (int i = 0; i < count; i++)
+  {
+    if (i > 0)
+      *out++ = ' ';
+    out = stpcpy(out, unexpanded_word(args[i], arena));
+  }
+  *out = '\0';
+  return text;
+}
+
+// Whether any of the words has a $ expansion to make. Here-document
+// bodies are raw text and never have one.
+static bool has_expansions(char **args, const TokenKind *kinds, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (kinds[i] == TOKEN_REDIRECT && args[i][0] == '<' && args[i][1] == '<' && args[i][2] != '<')
+      i++;
+    else if (strpbrk(args[i], EXPAND_MARKS) != NULL)
+      return true;
+  }
+  return false;
+}
+
+// NAME=value
+static bool is_assignment(const char *word)
+{
+  const char *equals = strchr(word, '=');
+  if (equals == NULL || equals == word)
+    return false;
+  for (const char *p = word; p < equals; p++)
+  {
+    if (!isalnum((unsigned char)*p) && *p != '_')
+      return false;
+  }
+  return !isdigit((unsigned char)*word);
+}
+
+// A pipeline, or a command on its own, up to the next separator, && or
+// ||; `time` in front of it sets `timed`. A newline after a | is skipped.
+// The Command shares the token stream's arrays when it runs to the end of
+// them unchanged, as a one-line command does; otherwise it gets copies
+// without those newlines and with reserved words made plain words.
+static Node *parse_pipeline(Parser *p)
+{
+  Command *tokens = p->tokens;
+  Node *node = new_node(p, NODE_COMMAND);
+  if (node == NULL)
+    return NULL;
+  int first = p->pos;
+  if (next_kind(p) == TOKEN_WORD && strcmp(tokens->args[p->pos], "time") == 0)
+  {
+    node->timed = true;
+    p->pos++;
+  }
+
+  int start = p->pos;
+  int count = 0;
+  bool shared = true;
+  bool stage_start = true;
+  while (!at_end(p) && !ends_pipeline(next_kind(p)))
+  {
+    TokenKind kind = next_kind(p);
+    if (kind == TOKEN_RESERVED)
+    {
+      // An if or loop can only start a list, not a stage or a timed command
+      if (stage_start && (p->pos > first || !at_keyword(p, "in")))
+      {
+        unexpected(p);
+        return NULL;
+      }
+      shared = false;
+    }
+    stage_start = kind == TOKEN_PIPE;
+    p->pos++;
+    count++;
+    while (kind == TOKEN_PIPE && !at_end(p) && next_kind(p) == TOKEN_NEWLINE)
+    {
+      p->pos++;
+      shared = false;
+    }
+  }
+  if (count == 0 && !node->timed)
+  {
+    unexpected(p);
+    return NULL;
+  }
+
+  Command *cmd = arena_alloc(p->arena, sizeof(Command));
+  if (cmd == NULL)
+  {
+    perror("Memory allocation failed");
+    return NULL;
+  }
+  if (shared && at_end(p))
+  {
+    // args[arg_count] is already NULL
+    cmd->args = tokens->args + start;
+    cmd->kinds = tokens->kinds + start;
+  }
+  else
+  {
+    cmd->args = arena_alloc(p->arena, (count + 1) * sizeof(char *));
+    cmd->kinds = arena_alloc(p->arena, (count ? count : 1) * sizeof(TokenKind));
+    if (cmd->args == NULL || cmd->kinds == NULL)
+    {
+      perror("Memory allocation failed");
+      return NULL;
+    }
+    int n = 0;
+    for (int i = start; i < p->pos; i++)
+    {
+      if (tokens->kinds[i] == TOKEN_NEWLINE)
+        continue;
+      cmd->args[n] = tokens->args[i];
+      cmd->kinds[n++] = tokens->kinds[i] == TOKEN_RESERVED ? TOKEN_WORD : tokens->kinds[i];
+    }
+    cmd->args[n] = NULL;
+  }
+  cmd->arg_count = count;
+  cmd->name = cmd->args[0];
+  // The line as typed when this is all of it, give or take a final "&"
+  bool whole =
+      first == 0 && (at_end(p) || (next_kind(p) == TOKEN_BACKGROUND && p->pos + 1 == tokens->arg_count));
+  cmd->text = whole ? tokens->text : join_words(cmd->args, count, p->arena);
+  cmd->background = false;
+  node->cmd = cmd;
+
+  node->expand = has_expansions(cmd->args, cmd->kinds, count);
+  if (count == 0 || has_pipeline(cmd))
+    return node;
+  if (!parse_redirection(cmd, &node->redir, p->arena))
+    return NULL;
+
+  int words = node->redir.operator_index != -1 ? node->redir.operator_index : count;
+  node->assignment = words > 0;
+  for (int i = 0; i < words && node->assignment; i++)
+    node->assignment = is_assignment(cmd->args[i]);
+  return node;
+}
+
+// A list of pipelines and constructs separated by ;, &, newlines, && and
+// ||, up to the end of the tokens or a reserved word that ends it. Only a
+// pipeline on its own can run in the background. Leading and trailing
+// newlines are skipped.
+static bool parse_list(Parser *p, Node **list)
+{
+  *list = NULL;
+  Node **tail = list;
+  bool chained = false; // After && or ||
+  skip_newlines(p);
+  while (!at_end(p) && !at_list_end(p))
+  {
+    Node *node = parse_node(p);
+    if (node == NULL)
+      return false;
+    *tail = node;
+    tail = &node->next;
+    if (at_end(p) || at_list_end(p))
+      break;
+
+    TokenKind kind = next_kind(p);
+    if (kind == TOKEN_AND || kind == TOKEN_OR)
+    {
+      node->link = kind == TOKEN_AND ? LINK_AND : LINK_OR;
+      chained = true;
+      p->pos++;
+      skip_newlines(p);
+      if (at_end(p) || at_list_end(p))
+        return unexpected(p);
+      continue;
+    }
+    if (kind == TOKEN_BACKGROUND && node->kind == NODE_COMMAND && !chained)
+      node->cmd->background = true;
+    else if (kind != TOKEN_SEMI && kind != TOKEN_NEWLINE)
+      return unexpected(p);
+    chained = false;
+    p->pos++;
+    skip_newlines(p);
+  }
+  return true;
+}
+
+// A list that has to have something in it, like the body of a loop
+static bool parse_body(Parser *p, Node **list)
+{
+  if (!parse_list(p, list))
+    return false;
+  return *list != NULL || unexpected(p);
+}
+
+static bool parse_do_group(Parser *p, Node **body)
+{
+  return expect(p, "do") && parse_body(p, body) && expect(p, "done");
+}
+
+// if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi. An elif
+// is an if of its own in the else branch, ending at the same fi.
+static Node *parse_if(Parser *p)
+{
+  Node *node = new_node(p, NODE_IF);
+  p->pos++; // if or elif
+  if (node == NULL || !parse_body(p, &node->condition) || !expect(p, "then") || !parse_body(p, &node->body))
+    return NULL;
+  if (at_keyword(p, "elif"))
+  {
+    node->otherwise = parse_if(p);
+    return node->otherwise != NULL ? node : NULL;
+  }
+  if (at_keyword(p, "else"))
+  {
+    p->pos++;
+    if (!parse_body(p, &node->otherwise))
+      return NULL;
+  }
+  return expect(p, "fi") ? node : NULL;
+}
+
+// while LIST; do LIST; done, or the same with until
+static Node *parse_loop(Parser *p)
+{
+  Node *node = new_node(p, at_keyword(p, "while") ? NODE_WHILE : NODE_UNTIL);
+  p->pos++;
+  if (node == NULL || !parse_body(p, &node->condition) || !parse_do_group(p, &node->body))
+    return NULL;
+  return node;
+}
+
+static bool is_name(const char *word)
+{
+  if (!isalpha((unsigned char)*word) && *word != '_')
+    return false;
+  while (isalnum((unsigned char)*word) || *word == '_')
+    word++;
+  return *word == '\0';
+}
+
+// for NAME [in WORD...]; do LIST; done. Without "in" there are no words,
+// as the shell has no positional parameters to stand in for them.
+static Node *parse_for(Parser *p)
+{
+  Node *node = new_node(p, NODE_FOR);
+  if (node == NULL)
+    return NULL;
+  p->pos++;
+  if (at_end(p) || next_kind(p) != TOKEN_WORD)
+  {
+    unexpected(p);
+    return NULL;
+  }
+  node->variable = p->tokens->args[p->pos++];
+  if (!is_name(node->variable))
+  {
+    parse_complain("`%s': not a valid identifier\n", node->variable);
+    return NULL;
+  }
+
+  skip_newlines(p);
+  if (at_keyword(p, "in"))
+  {
+    p->pos++;
+    int start = p->pos;
+    while (!at_end(p) && (next_kind(p) == TOKEN_WORD || next_kind(p) == TOKEN_RESERVED))
+      p->pos++;
+    node->words = p->tokens->args + start;
+    node->word_count = p->pos - start;
+    node->expand = has_expansions(node->words, p->tokens->kinds + start, node->word_count);
+    if (at_end(p) || (next_kind(p) != TOKEN_SEMI && next_kind(p) != TOKEN_NEWLINE))
+    {
+      unexpected(p);
+      return NULL;
+    }
+    p->pos++;
+  }
+  else if (!at_end(p) && next_kind(p) == TOKEN_SEMI)
+  {
+    p->pos++;
+  }
+  skip_newlines(p);
+  return parse_do_group(p, &node->body) ? node : NULL;
+}
+
+// Whether the token at `pos` starts an if or a loop
+static bool starts_construct(const Parser *p, int pos)
+{
+  if (pos >= p->tokens->arg_count || p->tokens->kinds[pos] != TOKEN_RESERVED)
+    return false;
+  const char *word = p->tokens->args[pos];
+  return strcmp(word, "if") == 0 || strcmp(word, "while") == 0 || strcmp(word, "until") == 0 ||
+         strcmp(word, "for") == 0;
+}
+
+static Node *parse_node(Parser *p)
+{
+  if (next_kind(p) == TOKEN_WORD && strcmp(p->tokens->args[p->pos], "time") == 0 &&
+      starts_construct(p, p->pos + 1))
+  {
+    // `time` before an if or loop times all of it
+    p->pos++;
+    Node *node = parse_node(p);
+    if (node != NULL)
+      node->timed = true;
+    return node;
+  }
+  if (at_keyword(p, "if"))
+    return parse_if(p);
+  if (at_keyword(p, "while") || at_keyword(p, "until"))
+    return parse_loop(p);
+  if (at_keyword(p, "for"))
+    return parse_for(p);
+  return parse_pipeline(p);
+}
+
+// Build the tree for the token stream `tokens`. Nodes, and the argument
+// arrays they do not share with `tokens`, come from `arena`.
+bool parse_tree(Command *tokens, Node **tree, Arena *arena)
+{
+  Parser p = {tokens, 0, arena};
+  if (!parse_list(&p, tree))
+    return false;
+  return at_end(&p) || unexpected(&p);
+}
@@ -0,0 +1,66 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "shell.h"
+
+// Command lists and the if, while, until and for constructs. The token
+// stream parse_command() returns is built once into a tree whose leaves
+// are ordinary Commands, each a pipeline or a command on its own, and a
+// loop runs its body by walking that tree again on every pass: nothing is
+// lexed or parsed twice, and the redirections of a command that is not a
+// pipeline are worked out while building. Only the $ expansions the lexer
+// marked are left for each run.
+//
+// A list is a chain of nodes through `next`. `link` says whether the next
+// node runs regardless (;, & or a newline), only if this one succeeded
+// (&&) or only if it failed (||); a node that is skipped leaves the status
+// as it was, so `a && b || c` runs c when either a or b fails.
+
+typedef enum
+{
+  NODE_COMMAND,
+  NODE_IF,
+  NODE_WHILE,
+  NODE_UNTIL,
+  NODE_FOR
+} NodeKind;
+
+typedef enum
+{
+  LINK_NEXT, // ;, & or a newline
+  LINK_AND,  // &&
+  LINK_OR    // ||
+} NodeLink;
+
+typedef struct Node
+{
+  NodeKind kind;
+  NodeLink link;
+  struct Node *next;
+  bool timed;  // After the `time` keyword
+  bool expand; // cmd or words hold $ expansions, made afresh on every run
+
+  Command *cmd;      // NODE_COMMAND
+  Redirection redir; // NODE_COMMAND, unless cmd is a pipeline or in the background
+  bool assignment;   // NODE_COMMAND: only NAME=value words, which set shell variables
+
+  struct Node *condition; // if, while, until: the list whose status decides
+  struct Node *body;      // then, or the loop body
+  struct Node *otherwise; // if: the else list, or the NODE_IF of an elif; NULL without one
+
+  const char *variable; // for: the name, set to each word in turn
+  char **words;         // for: the words after "in"
+  int word_count;
+} Node;
+
+// tree.c: in the shell_core library with the parser. Returns false after
+// reporting a syntax error; an empty command is an empty (NULL) list.
+bool parse_tree(Command *tokens, Node **tree, Arena *arena);
+
+// control.c
+void execute_tree(const Node *tree, Arena *arena);
+
+#endif
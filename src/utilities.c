@@ -0,0 +1,641 @@
+#define _GNU_SOURCE
+
+#include "builtins.h"
+#include "jobs.h"
+#include "output.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CAT_BUFFER_SIZE (128 * 1024)
+
+void execute_true(const Command *cmd, int end_index, FILE *out)
+{
+}
+
+void execute_false(const Command *cmd, int end_index, FILE *out)
+{
+  record_status(1);
+}
+
+// test and [ -------------------------------------------------------------
+
+typedef struct
+{
+  char **args;
+  int count;
+  int pos;
+  bool error; // Malformed: the status is 2 whatever the result
+} TestParser;
+
+static void test_error(TestParser *t, const char *arg, const char *message)
+{
+  if (!t->error)
+  {
+    if (arg != NULL)
+      fprintf(stderr, "test: %s: %s\n", arg, message);
+    else
+      fprintf(stderr, "test: %s\n", message);
+  }
+  t->error = true;
+}
+
+static bool test_integer(TestParser *t, const char *text, long long *value)
+{
+  char *end;
+  errno = 0;
+  *value = strtoll(text, &end, 10);
+  while (isspace((unsigned char)*end))
+    end++;
+  if (end == text || *end != '\0' || errno == ERANGE)
+  {
+    test_error(t, text, "integer expression expected");
+    return false;
+  }
+  return true;
+}
+
+static bool is_unary(const char *op)
+{
+  return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghkLnprsStuwxzOG", op[1]) != NULL;
+}
+
+static bool is_binary(const char *op)
+{
+  static const char *binary_ops[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne", "-lt",
+                                     "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+  for (int i = 0; binary_ops[i] != NULL; i++)
+  {
+    if (strcmp(op, binary_ops[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool unary_test(TestParser *t, char op, const char *arg)
+{
+  struct stat st;
+  long long fd;
+  switch (op)
+  {
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 't':
+    return test_integer(t, arg, &fd) && isatty((int)fd);
+  case 'r':
+    return access(arg, R_OK) == 0;
+  case 'w':
+    return access(arg, W_OK) == 0;
+  case 'x':
+    return access(arg, X_OK) == 0;
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+
+  if (stat(arg, &st) != 0)
+    return false;
+  switch (op)
+  {
+  case 'b':
+    return S_ISBLK(st.st_mode);
+  case 'c':
+    return S_ISCHR(st.st_mode);
+  case 'd':
+    return S_ISDIR(st.st_mode);
+  case 'f':
+    return S_ISREG(st.st_mode);
+  case 'g':
+    return (st.st_mode & S_ISGID) != 0;
+  case 'k':
+    return (st.st_mode & S_ISVTX) != 0;
+  case 'p':
+    return S_ISFIFO(st.st_mode);
+  case 's':
+    return st.st_size > 0;
+  case 'S':
+    return S_ISSOCK(st.st_mode);
+  case 'u':
+    return (st.st_mode & S_ISUID) != 0;
+  case 'O':
+    return st.st_uid == geteuid();
+  case 'G':
+    return st.st_gid == getegid();
+  default: // 'e'
+    return true;
+  }
+}
+
+static int compare_mtime(const struct stat *a, const struct stat *b)
+{
+  if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+    return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+  if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+    return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+static bool binary_test(TestParser *t, const char *left, const char *op, const char *right)
+{
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return strcmp(left, right) == 0;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(left, right) != 0;
+  if (strcmp(op, "<") == 0)
+    return strcmp(left, right) < 0;
+  if (strcmp(op, ">") == 0)
+    return strcmp(left, right) > 0;
+
+  if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+  {
+    struct stat a, b;
+    bool has_left = stat(left, &a) == 0;
+    bool has_right = stat(right, &b) == 0;
+    if (strcmp(op, "-ef") == 0)
+      return has_left && has_right && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    if (strcmp(op, "-nt") == 0)
+      return has_left && (!has_right || compare_mtime(&a, &b) > 0);
+    return has_right && (!has_left || compare_mtime(&a, &b) < 0);
+  }
+
+  long long x, y;
+  if (!test_integer(t, left, &x) || !test_integer(t, right, &y))
+    return false;
+  if (strcmp(op, "-eq") == 0)
+    return x == y;
+  if (strcmp(op, "-ne") == 0)
+    return x != y;
+  if (strcmp(op, "-lt") == 0)
+    return x < y;
+  if (strcmp(op, "-le") == 0)
+    return x <= y;
+  if (strcmp(op, "-gt") == 0)
+    return x > y;
+  return x >= y; // -ge
+}
+
+static bool test_or(TestParser *t);
+
+// A binary expression is tried first, so that `[ ! = ! ]` and
+// `[ ( = ( ]` compare strings as POSIX requires for three arguments.
+static bool test_primary(TestParser *t)
+{
+  if (t->pos >= t->count)
+  {
+    test_error(t, NULL, "argument expected");
+    return false;
+  }
+
+  char **args = t->args;
+  int pos = t->pos;
+  if (pos + 2 < t->count && is_binary(args[pos + 1]))
+  {
+    t->pos += 3;
+    return binary_test(t, args[pos], args[pos + 1], args[pos + 2]);
+  }
+  if (strcmp(args[pos], "(") == 0 && pos + 1 < t->count)
+  {
+    t->pos++;
+    bool value = test_or(t);
+    if (t->pos >= t->count || strcmp(args[t->pos], ")") != 0)
+      test_error(t, NULL, "`)' expected");
+    t->pos++;
+    return value;
+  }
+  if (is_unary(args[pos]) && pos + 1 < t->count)
+  {
+    t->pos += 2;
+    return unary_test(t, args[pos][1], args[pos + 1]);
+  }
+  t->pos++;
+  return args[pos][0] != '\0';
+}
+
+static bool test_not(TestParser *t)
+{
+  int pos = t->pos;
+  if (pos + 1 < t->count && strcmp(t->args[pos], "!") == 0 && !(pos + 2 < t->count && is_binary(t->args[pos + 1])))
+  {
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static bool test_and(TestParser *t)
+{
+  bool value = test_not(t);
+  while (t->pos < t->count && strcmp(t->args[t->pos], "-a") == 0)
+  {
+    t->pos++;
+    bool right = test_not(t);
+    value = value && right;
+  }
+  return value;
+}
+
+static bool test_or(TestParser *t)
+{
+  bool value = test_and(t);
+  while (t->pos < t->count && strcmp(t->args[t->pos], "-o") == 0)
+  {
+    t->pos++;
+    bool right = test_and(t);
+    value = value || right;
+  }
+  return value;
+}
+
+// test EXPRESSION / [ EXPRESSION ]: status 0 if true, 1 if false, 2 if
+// the expression is malformed.
+void execute_test(const Command *cmd, int end_index, FILE *out)
+{
+  int count = end_index - 1;
+  if (strcmp(cmd->name, "[") == 0)
+  {
+    if (count == 0 || strcmp(cmd->args[end_index - 1], "]") != 0)
+    {
+      fprintf(stderr, "[: missing `]'\n");
+      record_status(2);
+      return;
+    }
+    count--;
+  }
+
+  TestParser t = {cmd->args + 1, count, 0, false};
+  bool value;
+  if (count == 1)
+  {
+    value = t.args[0][0] != '\0'; // A lone operand is a string, even "("
+    t.pos = 1;
+  }
+  else
+  {
+    value = count > 0 && test_or(&t);
+  }
+  if (t.pos < count)
+    test_error(&t, t.args[t.pos], "unexpected argument");
+
+  record_status(t.error ? 2 : value ? 0 : 1);
+}
+
+// printf ------------------------------------------------------------------
+
+typedef struct
+{
+  char **args;
+  int count;
+  int next;
+  bool failed; // An argument was not a valid number
+} PrintfArgs;
+
+static const char *next_argument(PrintfArgs *a)
+{
+  return a->next < a->count ? a->args[a->next++] : "";
+}
+
+static long long integer_argument(PrintfArgs *a)
+{
+  const char *text = next_argument(a);
+  if (text[0] == '\'' || text[0] == '"')
+    return (unsigned char)text[1]; // 'c is the character's value
+
+  char *end;
+  errno = 0;
+  long long value = strtoll(text, &end, 0);
+  if (errno == ERANGE && text[0] != '-')
+  {
+    // Up to 2^64-1 still makes sense for %u and %x
+    errno = 0;
+    value = (long long)strtoull(text, &end, 0);
+    if (errno == ERANGE)
+      value = LLONG_MAX;
+  }
+  if (*text != '\0' && (end == text || *end != '\0'))
+  {
+    fprintf(stderr, "printf: %s: invalid number\n", text);
+    a->failed = true;
+  }
+  else if (errno == ERANGE)
+  {
+    fprintf(stderr, "printf: warning: %s: %s\n", text, strerror(ERANGE)); // Clamped, as bash does
+  }
+  return value;
+}
+
+static double float_argument(PrintfArgs *a)
+{
+  const char *text = next_argument(a);
+  if (text[0] == '\'' || text[0] == '"')
+    return (unsigned char)text[1];
+
+  char *end;
+  double value = strtod(text, &end);
+  if (*text != '\0' && (end == text || *end != '\0'))
+  {
+    fprintf(stderr, "printf: %s: invalid number\n", text);
+    a->failed = true;
+  }
+  return value;
+}
+
+// Write the escape sequence after a backslash at `*s` and move past it.
+// In a %b argument octal escapes are \0NNN and \c stops all output, for
+// which this returns false.
+static bool print_escape(const char **s, bool in_argument, FILE *out)
+{
+  const char *p = *s;
+  static const char from[] = "abfnrtv\\\"'";
+  static const char to[] = "\a\b\f\n\r\t\v\\\"'";
+  const char *known = *p != '\0' ? strchr(from, *p) : NULL;
+
+  if (known != NULL)
+  {
+    fputc(to[known - from], out);
+    p++;
+  }
+  else if (*p >= '0' && *p <= '7')
+  {
+    if (in_argument && *p == '0')
+      p++;
+    int value = 0;
+    for (int digits = 0; digits < 3 && *p >= '0' && *p <= '7'; digits++)
+      value = value * 8 + (*p++ - '0');
+    fputc(value & 0xff, out);
+  }
+  else if (*p == 'c' && in_argument)
+  {
+    *s = p + 1;
+    return false;
+  }
+  else
+  {
+    fputc('\\', out);
+    if (*p != '\0')
+      fputc(*p++, out);
+  }
+  *s = p;
+  return true;
+}
+
+// %b: the argument with its escapes expanded, then formatted as %s.
+static bool print_escaped_argument(const char *spec, const char *text, FILE *out)
+{
+  char *expanded = NULL;
+  size_t size = 0;
+  FILE *buffer = open_memstream(&expanded, &size);
+  if (buffer == NULL)
+  {
+    perror("open_memstream");
+    return true;
+  }
+
+  bool more = true;
+  for (const char *s = text; *s && more;)
+  {
+    if (*s == '\\')
+    {
+      s++;
+      more = print_escape(&s, true, buffer);
+    }
+    else
+    {
+      fputc(*s++, buffer);
+    }
+  }
+  fclose(buffer);
+  fprintf(out, spec, expanded != NULL ? expanded : "");
+  free(expanded);
+  return more;
+}
+
+// One pass over the format. Returns false after \c in a %b argument.
+static bool print_format(const char *format, PrintfArgs *a, FILE *out)
+{
+  for (const char *f = format; *f;)
+  {
+    if (*f == '\\')
+    {
+      f++;
+      print_escape(&f, false, out);
+      continue;
+    }
+    if (*f != '%')
+    {
+      fputc(*f++, out);
+      continue;
+    }
+    if (f[1] == '%')
+    {
+      fputc('%', out);
+      f += 2;
+      continue;
+    }
+
+    // %[flags][width][.precision]conversion, with * read from the arguments
+    char spec[64];
+    size_t n = 0;
+    spec[n++] = *f++;
+    while (*f && strchr("-+ #0", *f) != NULL && n < 8)
+      spec[n++] = *f++;
+    for (int part = 0; part < 2; part++)
+    {
+      if (part == 1)
+      {
+        if (*f != '.')
+          break;
+        spec[n++] = *f++;
+      }
+      if (*f == '*')
+      {
+        n += snprintf(spec + n, 24, "%d", (int)integer_argument(a));
+        f++;
+      }
+      else
+      {
+        while (isdigit((unsigned char)*f) && n < 40)
+          spec[n++] = *f++;
+      }
+    }
+
+    char conversion = *f;
+    if (conversion == '\0' || strchr("diouxXcsbfFeEgGaA", conversion) == NULL)
+    {
+      fprintf(stderr, "printf: %%%c: invalid directive\n", conversion);
+      a->failed = true;
+      return true;
+    }
+    f++;
+
+    if (strchr("diouxX", conversion) != NULL)
+    {
+      spec[n++] = 'l';
+      spec[n++] = 'l';
+      spec[n++] = conversion;
+      spec[n] = '\0';
+      fprintf(out, spec, integer_argument(a));
+    }
+    else if (strchr("fFeEgGaA", conversion) != NULL)
+    {
+      spec[n++] = conversion;
+      spec[n] = '\0';
+      fprintf(out, spec, float_argument(a));
+    }
+    else if (conversion == 'c')
+    {
+      spec[n++] = 'c';
+      spec[n] = '\0';
+      const char *text = next_argument(a);
+      if (text[0] != '\0')
+        fprintf(out, spec, text[0]);
+    }
+    else
+    {
+      spec[n++] = 's';
+      spec[n] = '\0';
+      const char *text = next_argument(a);
+      if (conversion == 'b' && !print_escaped_argument(spec, text, out))
+        return false;
+      if (conversion == 's')
+        fprintf(out, spec, text);
+    }
+  }
+  return true;
+}
+
+// printf FORMAT [ARGUMENT]...: the format is reused while arguments remain.
+void execute_printf(const Command *cmd, int end_index, FILE *out)
+{
+  int first = 1;
+  if (first < end_index && strcmp(cmd->args[first], "--") == 0)
+    first++;
+  if (first >= end_index)
+  {
+    fprintf(stderr, "printf: usage: printf FORMAT [ARGUMENT]...\n");
+    record_status(2);
+    return;
+  }
+
+  PrintfArgs a = {cmd->args + first + 1, end_index - first - 1, 0, false};
+  while (print_format(cmd->args[first], &a, out) && a.next > 0 && a.next < a.count)
+    ;
+  if (a.failed)
+    record_status(1);
+}
+
+// cat ---------------------------------------------------------------------
+
+// Copy `fd` to fd 1. Returns false on a read error, a write error (such as
+// a reader that went away) or ^C.
+static bool copy_to_stdout(int fd, const char *name, char *buffer)
+{
+  while (true)
+  {
+    ssize_t got = read(fd, buffer, CAT_BUFFER_SIZE);
+    if (got == 0)
+      return true;
+    if (got == -1 && errno == EINTR)
+    {
+      if (!jobs_take_interrupt())
+        continue;
+      fprintf(stderr, "\n");
+      record_status(128 + SIGINT);
+      return false;
+    }
+    if (got == -1)
+    {
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+      record_status(1);
+      return true;
+    }
+    if (!write_all(STDOUT_FILENO, buffer, got))
+    {
+      record_status(1);
+      return false;
+    }
+  }
+}
+
+// Only plain `cat [-u] [--] [FILE]...` runs in the shell; any other option,
+// wherever it is, goes to the cat in PATH, which knows -n, -A, -s and the
+// rest.
+bool cat_accepts(const Command *cmd, int end_index)
+{
+  for (int i = 1; i < end_index && strcmp(cmd->args[i], "--") != 0; i++)
+  {
+    const char *word = cmd->args[i];
+    if (word[0] == '-' && word[1] != '\0' && strcmp(word, "-u") != 0)
+      return false;
+  }
+  return true;
+}
+
+// Whether `word` is an option to the in-process cat rather than a file:
+// -u anywhere before "--" (output is never buffered anyway), or the first
+// "--", which ends the options.
+static bool is_cat_option(const char *word, bool *options_done)
+{
+  if (*options_done || (strcmp(word, "-u") != 0 && strcmp(word, "--") != 0))
+    return false;
+  *options_done = word[1] == '-';
+  return true;
+}
+
+// cat [-u] [FILE]...: files, or stdin for none or "-", in large reads and
+// writes. The data goes straight to fd 1 rather than through `out`, so it
+// is never held in memory whole.
+void execute_cat(const Command *cmd, int end_index, FILE *out)
+{
+  char *buffer = malloc(CAT_BUFFER_SIZE);
+  if (buffer == NULL)
+  {
+    perror("Memory allocation failed");
+    record_status(1);
+    return;
+  }
+
+  bool options_done = false;
+  int files = 0;
+  for (int i = 1; i < end_index; i++)
+    files += !is_cat_option(cmd->args[i], &options_done);
+
+  if (files == 0)
+    copy_to_stdout(STDIN_FILENO, "-", buffer);
+  options_done = false;
+  for (int i = 1; i < end_index; i++)
+  {
+    const char *name = cmd->args[i];
+    if (is_cat_option(name, &options_done))
+      continue;
+    if (strcmp(name, "-") == 0)
+    {
+      if (!copy_to_stdout(STDIN_FILENO, name, buffer))
+        break;
+      continue;
+    }
+
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+      record_status(1);
+      continue;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool ok = copy_to_stdout(fd, name, buffer);
+    close(fd);
+    if (!ok)
+      break;
+  }
+  free(buffer);
+}
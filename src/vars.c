@@ -0,0 +1,339 @@
+#include "vars.h"
+#include "builtins.h"
+#include "hash.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARS_INITIAL_SLOTS 64
+
+extern char **environ;
+
+typedef struct
+{
+  char *entry; // "NAME=value"; NULL for a free slot
+  size_t name_length;
+  bool exported;
+} Var;
+
+// Linear probing over a power-of-two table kept at most 3/4 full. Unset
+// moves the rest of a probe run back instead of leaving tombstones.
+static Var *slots = NULL;
+static size_t slot_count = 0;
+static size_t var_count = 0;
+
+// The exported variables as an envp array, the pointers and the strings
+// in one block, and whether a change has made it out of date
+static char **exported_env = NULL;
+static bool env_stale = true;
+
+// The slot holding `name`, or the free one it would go in
+static Var *find_slot(const char *name, size_t length)
+{
+  size_t mask = slot_count - 1;
+  for (size_t i = hash_bytes(name, length) & mask;; i = (i + 1) & mask)
+  {
+    Var *var = &slots[i];
+    if (var->entry == NULL || (var->name_length == length && memcmp(var->entry, name, length) == 0))
+      return var;
+  }
+}
+
+static Var *find_var(const char *name, size_t length)
+{
+  if (slot_count == 0)
+    return NULL;
+  Var *var = find_slot(name, length);
+  return var->entry != NULL ? var : NULL;
+}
+
+static bool grow_slots(void)
+{
+  size_t new_count = slot_count ? slot_count * 2 : VARS_INITIAL_SLOTS;
+  Var *new_slots = calloc(new_count, sizeof(Var));
+  if (new_slots == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+
+  Var *old_slots = slots;
+  size_t old_count = slot_count;
+  slots = new_slots;
+  slot_count = new_count;
+  for (size_t i = 0; i < old_count; i++)
+  {
+    if (old_slots[i].entry != NULL)
+      *find_slot(old_slots[i].entry, old_slots[i].name_length) = old_slots[i];
+  }
+  free(old_slots);
+  return true;
+}
+
+static bool is_path(const char *name, size_t length)
+{
+  return length == 4 && memcmp(name, "PATH", 4) == 0;
+}
+
+// Set the variable `name` (`length` bytes of it) to `value`, exporting it
+// too if `export`. Giving a variable the value it already has changes
+// nothing, so it neither dirties the envp nor counts as a new PATH.
+static bool store(const char *name, size_t length, const char *value, bool export)
+{
+  if ((var_count + 1) * 4 > slot_count * 3 && !grow_slots())
+    return false;
+
+  Var *var = find_slot(name, length);
+  bool added = var->entry == NULL;
+  if (!added && strcmp(var->entry + length + 1, value) == 0)
+  {
+    if (export && !var->exported)
+      env_stale = true;
+    var->exported |= export;
+    return true;
+  }
+
+  size_t value_length = strlen(value);
+  char *entry = malloc(length + value_length + 2);
+  if (entry == NULL)
+  {
+    perror("Memory allocation failed");
+    return false;
+  }
+  memcpy(entry, name, length);
+  entry[length] = '=';
+  memcpy(entry + length + 1, value, value_length + 1);
+
+  free(var->entry); // The envp has its own copy
+  var->entry = entry;
+  var->name_length = length;
+  if (added)
+  {
+    var->exported = false;
+    var_count++;
+  }
+  var->exported |= export;
+  if (var->exported)
+    env_stale = true;
+  if (is_path(name, length))
+    path_changed(entry + length + 1);
+  return true;
+}
+
+bool is_variable_name(const char *name, size_t length)
+{
+  if (length == 0 || isdigit((unsigned char)name[0]))
+    return false;
+  for (size_t i = 0; i < length; i++)
+  {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+      return false;
+  }
+  return true;
+}
+
+// Take in the environment the shell was started with, every variable in
+// it exported.
+void vars_init(char **envp)
+{
+  for (char **env = envp; *env != NULL; env++)
+  {
+    const char *equals = strchr(*env, '=');
+    if (equals != NULL && is_variable_name(*env, equals - *env))
+      store(*env, equals - *env, equals + 1, true);
+  }
+}
+
+// The value of the variable named by the first `length` bytes of `name`,
+// or NULL if it is not set
+const char *vars_lookup(const char *name, size_t length)
+{
+  Var *var = find_var(name, length);
+  return var != NULL ? var->entry + length + 1 : NULL;
+}
+
+const char *vars_get(const char *name)
+{
+  return vars_lookup(name, strlen(name));
+}
+
+bool vars_set(const char *name, const char *value)
+{
+  return store(name, strlen(name), value, false);
+}
+
+// Set a variable from "NAME=value"; the caller has checked the name
+bool vars_assign(const char *assignment, bool export)
+{
+  const char *equals = strchr(assignment, '=');
+  return store(assignment, equals - assignment, equals + 1, export);
+}
+
+// Export a variable that is set; one that is not stays unset
+void vars_export(const char *name)
+{
+  Var *var = find_var(name, strlen(name));
+  if (var == NULL)
+    return;
+  if (!var->exported)
+    env_stale = true;
+  var->exported = true;
+}
+
+void vars_unset(const char *name)
+{
+  size_t length = strlen(name);
+  Var *var = find_var(name, length);
+  if (var == NULL)
+    return;
+  if (var->exported)
+    env_stale = true;
+  free(var->entry);
+  var_count--;
+
+  // Move later entries of the run back into the gap whenever their home
+  // slot is not between the gap and where they are now
+  size_t mask = slot_count - 1;
+  size_t gap = var - slots;
+  for (size_t i = (gap + 1) & mask; slots[i].entry != NULL; i = (i + 1) & mask)
+  {
+    size_t home = hash_bytes(slots[i].entry, slots[i].name_length) & mask;
+    if (((i - home) & mask) >= ((i - gap) & mask))
+    {
+      slots[gap] = slots[i];
+      gap = i;
+    }
+  }
+  slots[gap].entry = NULL;
+
+  if (is_path(name, length))
+    path_changed(NULL);
+}
+
+// The envp for a new program: the exported variables. It is built again
+// only when one of them has changed since the last call, and `environ`
+// follows it so getenv() agrees with what children are given.
+char **vars_environ(void)
+{
+  if (!env_stale)
+    return exported_env;
+
+  long long start = trace_begin();
+  size_t count = 0;
+  size_t bytes = 0;
+  for (size_t i = 0; i < slot_count; i++)
+  {
+    if (slots[i].entry != NULL && slots[i].exported)
+    {
+      count++;
+      bytes += strlen(slots[i].entry) + 1;
+    }
+  }
+
+  char **env = malloc((count + 1) * sizeof(char *) + bytes);
+  if (env == NULL)
+  {
+    perror("Memory allocation failed");
+    return exported_env != NULL ? exported_env : environ;
+  }
+  char *out = (char *)(env + count + 1);
+  size_t n = 0;
+  for (size_t i = 0; i < slot_count; i++)
+  {
+    if (slots[i].entry != NULL && slots[i].exported)
+    {
+      env[n++] = out;
+      out = stpcpy(out, slots[i].entry) + 1;
+    }
+  }
+  env[n] = NULL;
+
+  free(exported_env);
+  exported_env = env;
+  environ = env;
+  env_stale = false;
+  trace_end("envp", start, -1);
+  return env;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// `export NAME="value"` for every exported variable, sorted by name
+static void print_exported(FILE *out)
+{
+  char **env = vars_environ();
+  size_t count = 0;
+  while (env[count] != NULL)
+    count++;
+  char **sorted = malloc((count ? count : 1) * sizeof(char *));
+  if (sorted == NULL)
+  {
+    perror("Memory allocation failed");
+    return;
+  }
+  memcpy(sorted, env, count * sizeof(char *));
+  qsort(sorted, count, sizeof(char *), compare_entries);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *equals = strchr(sorted[i], '=');
+    fprintf(out, "export %.*s=\"", (int)(equals - sorted[i]), sorted[i]);
+    for (const char *p = equals + 1; *p; p++)
+    {
+      if (*p == '"' || *p == '\\' || *p == '$' || *p == '`')
+        fputc('\\', out);
+      fputc(*p, out);
+    }
+    fprintf(out, "\"\n");
+  }
+  free(sorted);
+}
+
+// export [NAME[=value]]...: without arguments, list what is exported
+void execute_export(const Command *cmd, int end_index, FILE *out)
+{
+  if (end_index == 1)
+  {
+    print_exported(out);
+    return;
+  }
+  for (int i = 1; i < end_index; i++)
+  {
+    const char *word = cmd->args[i];
+    const char *equals = strchr(word, '=');
+    size_t length = equals != NULL ? (size_t)(equals - word) : strlen(word);
+    if (!is_variable_name(word, length))
+    {
+      fprintf(stderr, "export: `%s': not a valid identifier\n", word);
+      record_status(1);
+    }
+    else if (equals == NULL)
+    {
+      vars_export(word);
+    }
+    else if (!vars_assign(word, true))
+    {
+      record_status(1);
+    }
+  }
+}
+
+// unset NAME...
+void execute_unset(const Command *cmd, int end_index, FILE *out)
+{
+  for (int i = 1; i < end_index; i++)
+  {
+    if (!is_variable_name(cmd->args[i], strlen(cmd->args[i])))
+    {
+      fprintf(stderr, "unset: `%s': not a valid identifier\n", cmd->args[i]);
+      record_status(1);
+      continue;
+    }
+    vars_unset(cmd->args[i]);
+  }
+}
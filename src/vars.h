@@ -0,0 +1,38 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "shell.h"
+
+// Shell variables, in an open-addressing hash table keyed by name. Each
+// is kept as the "NAME=value" string the environment uses, and the ones
+// marked for export make up the envp every program is started with.
+// That array is built again only after an exported variable changed, so
+// running a command costs nothing here however many variables there are.
+// Assigning PATH a new value, or unsetting it, calls path_changed() once.
+
+void vars_init(char **envp);
+const char *vars_get(const char *name);
+const char *vars_lookup(const char *name, size_t length);
+bool vars_set(const char *name, const char *value);
+bool vars_assign(const char *assignment, bool export);
+void vars_export(const char *name);
+void vars_unset(const char *name);
+char **vars_environ(void);
+bool is_variable_name(const char *name, size_t length);
+
+// expand.c: $ expansion of the words the lexer marked, done on every run
+// so a loop body sees the values of each pass. Unquoted values are split
+// into fields at blanks and newlines, and a word left with no fields is
+// dropped; a here-document body and a redirection's word are never split.
+Command *expand_command(const Command *cmd, Arena *arena);
+char *expand_word(const char *word, Arena *arena);
+bool expand_words(char **words, int count, char ***fields, int *field_count, Arena *arena);
+
+// main.c
+void path_changed(const char *path);
+
+#endif